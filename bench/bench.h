@@ -0,0 +1,48 @@
+#ifndef HADRON_BENCH_H
+#define HADRON_BENCH_H 1
+
+#include <chrono>
+#include <cstddef>
+
+#define BENCH_RUNS 5
+
+// Fastest wall-clock time of `runs` calls to `fn`, in seconds
+template <typename F> double bench_time(const int runs, F &&fn) {
+  double best = 0;
+  for (int i = 0; i < runs; i++) {
+    const auto start = std::chrono::steady_clock::now();
+    fn();
+    const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    if (i == 0 || elapsed.count() < best)
+      best = elapsed.count();
+  }
+  return best;
+}
+
+typedef struct BenchResult {
+  const char *suite;
+  const char *name;
+  double      seconds;
+  size_t      bytes;  // of source or input processed
+  size_t      tokens; // 0 when not counted
+  size_t      code;   // bytes of bytecode produced, 0 when not counted
+} BenchResult;
+
+// Prints one measurement, as a table row or as a JSON object with --json
+void bench_record(const BenchResult &result);
+void bench_report(
+  const char *suite, const char *name, double seconds, size_t bytes);
+// Any other output, kept out of the JSON document on stdout
+void bench_note(const char *format, ...);
+
+void bench_file();
+void bench_lexer();
+void bench_number();
+void bench_tokenize();
+void bench_document();
+void bench_frontend();
+void bench_build();
+void bench_symbol();
+
+#endif // HADRON_BENCH_H
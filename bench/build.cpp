@@ -0,0 +1,60 @@
+#include "bench.h"
+#include "build.h"
+#include "file.h"
+
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#define BUILD_DIR     "hadron_bench_build"
+#define BUILD_SOURCES 0x400
+
+// Small modules of a few functions each, the way a project is split up
+static size_t write_sources() {
+  mkdir(BUILD_DIR, 0755);
+  size_t bytes = 0;
+  for (int i = 0; i < BUILD_SOURCES; i++) {
+    std::string source;
+    for (int j = 0; j < 3; j++) {
+      source += "fx f" + std::to_string(j) + "(i32 a, b) {\n  i32 c = a * b + " +
+                std::to_string(i) + "\n  c * (a - " + std::to_string(j) +
+                ") / (b + 1)\n}\n";
+    }
+    source += "f0(2, 3) + f1(4, 5) * f2(1, 1)\n";
+
+    const std::string path = BUILD_DIR "/m" + std::to_string(i) + ".hdn";
+    File              out(path.c_str(), FILE_MODE_WRITE);
+    out.write(source.data(), source.size());
+    bytes += source.size();
+  }
+  return bytes;
+}
+
+static void remove_sources() {
+  for (int i = 0; i < BUILD_SOURCES; i++) {
+    const std::string path = BUILD_DIR "/m" + std::to_string(i);
+    unlink((path + ".hdn").c_str());
+    unlink((path + ".hbc").c_str());
+  }
+  rmdir(BUILD_DIR);
+}
+
+// The same tree on twice as many workers each time, up to one per core
+void bench_build() {
+  const size_t   bytes = write_sources();
+  const unsigned cores = std::thread::hardware_concurrency();
+  for (unsigned threads = 1;; threads *= 2) {
+    if (threads > cores)
+      threads = cores ? cores : 1;
+    const double seconds = bench_time(BENCH_RUNS, [&] {
+      build(BUILD_DIR, 0, threads);
+    });
+    char name[64];
+    snprintf(name, sizeof(name), "%u threads", threads);
+    bench_report("build", name, seconds, bytes);
+    if (threads >= cores)
+      break;
+  }
+  remove_sources();
+}
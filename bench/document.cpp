@@ -0,0 +1,251 @@
+#include "bench.h"
+#include "document.h"
+#include "parser.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#define VERIFY_EDITS     2000
+#define BENCH_EDITS      1000
+#define LINK_SOURCE_SIZE 0x180 // small enough to link into one chunk
+
+// Every line is a whole statement, so lines can be joined freely. Function
+// and local names have to be unique within the script, and there are at most
+// UINT8_MAX locals. Functions call the one defined before them, expressions
+// call one defined above and one defined below.
+static std::string program(const size_t size) {
+  std::string source;
+  for (int i = 0; source.size() < size; i++) {
+    switch (i % 4) {
+      case 0:
+        if (i < 0x200) {
+          source += "fx f_" + std::to_string(i) + "() { " +
+                    std::to_string(i) + " + 2 * " +
+                    (i ? "f_" + std::to_string(i - 4) + "()" : "3") + " }\n";
+          break;
+        }
+        source += std::to_string(i) + " + 2 * 3\n";
+        break;
+      case 1:
+        if (i < 0x200) {
+          source += "int x_" + std::to_string(i) + " = " + std::to_string(i) +
+                    ".5 - 0x1F\n";
+          break;
+        }
+        source += std::to_string(i) + ".5 - 0x1F\n";
+        break;
+      case 2:
+        source += "/* block\n comment */ 1 + 2 ** 3 // tail\n";
+        break;
+      default:
+        if (i < 0x200) {
+          source += "(4 - x_" + std::to_string(i - 2) + ") * 0b101 + f_" +
+                    std::to_string(i - 3) + "()";
+          if (i + 1 < 0x200)
+            source += " - f_" + std::to_string(i + 1) + "()";
+          source += "\n";
+          break;
+        }
+        source += "(4 - " + std::to_string(i % 7) + ") * 0b101\n";
+    }
+  }
+  return source;
+}
+
+static bool same_tokens(const Token &a, const Token &b) {
+  return a.type == b.type && a.flags == b.flags && a.offset == b.offset &&
+         a.length == b.length;
+}
+
+// Line tables are compared after moving them to the lines they describe now
+static bool same_units(const Document &a, const Document &b) {
+  const auto x       = a.unit_list();
+  const auto y       = b.unit_list();
+  const auto a_token = a.token_list();
+  const auto b_token = b.token_list();
+  if (x.size() != y.size())
+    return false;
+  for (size_t i = 0; i < x.size(); i++) {
+    if (x[i].first != y[i].first || x[i].count != y[i].count ||
+        x[i].code != y[i].code)
+      return false;
+    LineTable lx;
+    LineTable ly;
+    lx.append(x[i].lines.data(), x[i].lines.size(), 0,
+      a.line_index().line(a_token[x[i].first].offset) - x[i].line);
+    ly.append(y[i].lines.data(), y[i].lines.size(), 0,
+      b.line_index().line(b_token[y[i].first].offset) - y[i].line);
+    if (lx.size != ly.size || memcmp(lx.data, ly.data, lx.size) != 0)
+      return false;
+  }
+  return true;
+}
+
+// Whether a line break in front of token `index` keeps the program valid
+static bool can_break(const std::vector<Token> &tokens, const size_t index) {
+  if (!index || tokens[index].flags & TOKEN_NEWLINE)
+    return true;
+  // groups have to close on the line they open on
+  int depth = 0;
+  for (size_t i = index; i-- > 0;) {
+    depth += (tokens[i].type == Types::L_PAREN) -
+             (tokens[i].type == Types::R_PAREN);
+    if (tokens[i].flags & TOKEN_NEWLINE)
+      break;
+  }
+  if (depth > 0)
+    return false;
+  switch (tokens[index - 1].type) {
+    case Types::ADD:
+    case Types::SUB:
+    case Types::MUL:
+    case Types::POW:
+    case Types::L_CURLY:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// A random edit that keeps the program valid
+static void random_edit(Document &document) {
+  const std::string   text   = document.source();
+  const auto          tokens = document.token_list();
+  const size_t        index  = rand() % (tokens.size() - 1);
+  const Token        &token  = tokens[index];
+  const size_t        start  = token.offset;
+  static const char *numbers[]  = {"7", "12.25", "0x2A", "0o17", "1e3", "0"};
+  static const char *comments[] = {"/* x\n y */ ", "// z\n", "/* x */ "};
+
+  switch (rand() % 5) {
+    case 0: // another number
+      if (token.type == Types::DEC || token.type == Types::HEX ||
+          token.type == Types::OCTAL || token.type == Types::BINARY) {
+        const char *number = numbers[rand() % 6];
+        document.edit(start, token.length, number,
+          strlen(number));
+      }
+      break;
+    case 1: { // a comment in front of a token
+      const char *comment = comments[can_break(tokens, index) ? rand() % 3 : 2];
+      document.edit(start, 0, comment, strlen(comment));
+      break;
+    }
+    case 2: // a line break in front of a token
+      if (can_break(tokens, index))
+        document.edit(start, 0, "\n", 1);
+      break;
+    case 3: { // a new statement in front of another one
+      const auto &units = document.unit_list();
+      const Token &first = tokens[units[rand() % units.size()].first];
+      document.edit(first.offset, 0, "9 - 8 * 7\n", 10);
+      break;
+    }
+    default: { // two statements on one line
+      const auto  &units = document.unit_list();
+      const auto  &unit  = units[rand() % units.size()];
+      const Token &last  = tokens[unit.first + unit.count - 1];
+      const Token &next  = tokens[unit.first + unit.count];
+      const size_t end   = last.offset + last.length;
+      if (text.compare(end, 1, "\n") == 0 && next.offset == end + 1)
+        document.edit(end, 1, "; ", 2);
+    }
+  }
+}
+
+static void verify() {
+  srand(7);
+  const std::string source = program(0x2000);
+  Document          document(source.c_str(), source.size());
+  for (int i = 0; i < VERIFY_EDITS; i++) {
+    random_edit(document);
+    const std::string text = document.source();
+    const Document    fresh(text.c_str(), text.size());
+    const auto        x = document.token_list();
+    const auto        y = fresh.token_list();
+    bool              same = x.size() == y.size() && same_units(document, fresh);
+    for (size_t t = 0; same && t < x.size(); t++)
+      same = same_tokens(x[t], y[t]);
+    if (!same) {
+      fprintf(stderr, "document: edit %d differs from a full rebuild\n", i);
+      exit(1);
+    }
+  }
+}
+
+// Links the document after every edit, which has to give the code of a full
+// compile. A chunk holds MAX_INSTRUCTIONS bytes, the document starts over
+// once its statements take more.
+static void verify_link() {
+  srand(11);
+  const std::string source = program(LINK_SOURCE_SIZE);
+  Document          document(source.c_str(), source.size());
+  static Chunk      linked;
+  static Chunk      compiled;
+  for (int i = 0; i < VERIFY_EDITS; i++) {
+    random_edit(document);
+    size_t size = 0;
+    for (const DocumentUnit &unit : document.unit_list())
+      size += unit.code.size();
+    if (size > MAX_INSTRUCTIONS) {
+      document = Document(source.c_str(), source.size());
+      continue;
+    }
+    document.link(linked);
+
+    const std::string text = document.source();
+    Input             input(text.c_str(), text.size());
+    Lexer             lexer(input);
+    Parser            parser(lexer, compiled);
+    compiled.clear();
+    parser.parse();
+    if (linked.pos != compiled.pos ||
+        memcmp(linked.code, compiled.code, compiled.pos) != 0 ||
+        linked.lines.size != compiled.lines.size ||
+        memcmp(linked.lines.data, compiled.lines.data, compiled.lines.size)) {
+      fprintf(stderr, "document: edit %d links other code than a compile\n",
+        i);
+      exit(1);
+    }
+  }
+}
+
+void bench_document() {
+  verify();
+  verify_link();
+  for (const size_t size : {0x10000UL, 0x100000UL, 0x800000UL}) {
+    const std::string source = program(size);
+    double            build  = bench_time(1, [&] {
+      Document document(source.c_str(), source.size());
+    });
+
+    // Rewrites a number near the middle, growing and shrinking it in turn
+    Document     document(source.c_str(), source.size());
+    const auto  &tokens = document.token_list();
+    size_t       target = tokens.size() / 2;
+    while (tokens[target].type != Types::DEC)
+      target++;
+    const size_t offset = tokens[target].offset;
+    size_t       length = tokens[target].length;
+    // The first edit moves the gaps from the end of the document to it
+    document.edit(offset, length, "42", 2);
+    length = 2;
+    size_t       tokens_lexed = 0;
+    size_t       statements   = 0;
+    const double seconds      = bench_time(1, [&] {
+      for (int i = 0; i < BENCH_EDITS; i++) {
+        const char *number = i % 2 ? "42" : "4200";
+        document.edit(offset, length, number, strlen(number));
+        length = strlen(number);
+        tokens_lexed += document.relexed;
+        statements += document.reparsed;
+      }
+    });
+    bench_note("document %-7zu KiB  rebuild %9.3f ms  edit %7.2f us  "
+               "(%zu tokens, %zu statements per edit)\n",
+      size >> 10, build * 1e3, seconds / BENCH_EDITS * 1e6,
+      tokens_lexed / BENCH_EDITS, statements / BENCH_EDITS);
+  }
+}
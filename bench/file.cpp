@@ -0,0 +1,60 @@
+#include "bench.h"
+#include "file.h"
+
+#include <unistd.h>
+
+#define BENCH_FILE      "hadron_bench.hbc"
+#define BENCH_CODE_SIZE 0x800000UL // 8 MiB of bytecode
+#define BENCH_SECTIONS  0x10
+
+static uint8_t code[BENCH_CODE_SIZE];
+
+void bench_file() {
+  for (size_t i = 0; i < BENCH_CODE_SIZE; i++) {
+    code[i] = static_cast<uint8_t>(i * 31);
+  }
+  char name[] = "hadron_bench";
+
+  double seconds = bench_time(BENCH_RUNS, [&] {
+    File out(BENCH_FILE, FILE_MODE_WRITE);
+    if (out.write_header() != FILE_STATUS_OK) {
+      Logger::fatal("Failed to write header");
+    }
+    out << name;
+    for (size_t i = 0; i < BENCH_CODE_SIZE; i++) {
+      out << code[i];
+    }
+  });
+  bench_report("file", "write per byte", seconds, BENCH_CODE_SIZE);
+
+  seconds = bench_time(BENCH_RUNS, [&] {
+    File out(BENCH_FILE, FILE_MODE_WRITE);
+    if (out.write_header() != FILE_STATUS_OK) {
+      Logger::fatal("Failed to write header");
+    }
+    out << name;
+    out.write(code, BENCH_CODE_SIZE);
+  });
+  bench_report("file", "write span", seconds, BENCH_CODE_SIZE);
+
+  seconds = bench_time(BENCH_RUNS, [&] {
+    File       out(BENCH_FILE, FILE_MODE_WRITE);
+    FileHeader header;
+    out.fill_header(&header);
+
+    iovec sections[BENCH_SECTIONS + 2] = {
+      {&header, sizeof(FileHeader)},
+      {name, header.name},
+    };
+    constexpr size_t section_size = BENCH_CODE_SIZE / BENCH_SECTIONS;
+    for (size_t i = 0; i < BENCH_SECTIONS; i++) {
+      sections[i + 2] = {code + i * section_size, section_size};
+    }
+    if (out.write_vectored(sections, BENCH_SECTIONS + 2) != FILE_STATUS_OK) {
+      Logger::fatal("Failed to write bytecode");
+    }
+  });
+  bench_report("file", "write vectored", seconds, BENCH_CODE_SIZE);
+
+  unlink(BENCH_FILE);
+}
@@ -0,0 +1,159 @@
+#include "bench.h"
+#include "parser.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#define FRONTEND_SOURCE_SIZE 0x800000UL // 8 MiB per corpus
+#define FRONTEND_SYMBOLS     0x40       // statements between symbol resets
+
+typedef struct Corpus {
+  const char *name;
+  std::string source;
+} Corpus;
+
+// Values of top-level statements are dropped at -O2, all but the last. The
+// corpora return theirs from functions instead, whose names repeat every
+// FRONTEND_SYMBOLS functions, when the table is reset. A parameter in each
+// expression keeps it from being folded into a constant.
+static std::string function(const char *name, const int i) {
+  return "fx " + std::string(name) + "_" +
+         std::to_string(i % FRONTEND_SYMBOLS) + "(x) { ";
+}
+
+// Parenthesised expressions nested 24 deep, one per line
+static std::string expressions() {
+  static const char *operators[] = {" + ", " - ", " * ", " / "};
+  std::string        source;
+  for (int i = 0; source.size() < FRONTEND_SOURCE_SIZE; i++) {
+    std::string expression = "x";
+    for (int depth = 1; depth <= 24; depth++) {
+      expression = "(" + expression + operators[(i + depth) % 4] +
+                   std::to_string(depth) + ")";
+    }
+    source += function("expression", i) + expression + " }\n";
+  }
+  return source;
+}
+
+static std::string functions() {
+  std::string source;
+  for (int i = 0; source.size() < FRONTEND_SOURCE_SIZE; i++) {
+    source += function("function", i) + "\n  int y = x * 2 + " +
+              std::to_string(i) + "\n  (y - " + std::to_string(i % 7) +
+              ") ** 2\n}\n";
+  }
+  return source;
+}
+
+// String literals are interned, they compile to no code at any level
+static std::string strings() {
+  std::string source;
+  for (int i = 0; source.size() < FRONTEND_SOURCE_SIZE; i++) {
+    source += "\"" + std::to_string(i) +
+              " lorem ipsum dolor sit amet, consectetur \\\"adipiscing\\\" "
+              "elit, sed do eiusmod tempor incididunt ut labore et dolore "
+              "magna aliqua, ut enim ad minim veniam, quis nostrud\"\n";
+  }
+  return source;
+}
+
+static std::string numbers() {
+  std::string source;
+  for (int i = 0; source.size() < FRONTEND_SOURCE_SIZE; i++) {
+    source += function("number", i) + "x * " + std::to_string(i) +
+              ".125e-3 + 0x1F" + std::to_string(i % 10) +
+              " * 0b1011 - 0o17 / 3.14159265358979 + 6.02214076e23 * " +
+              std::to_string(i % 1000) + " }\n";
+  }
+  return source;
+}
+
+static std::vector<Token> lex(const std::string &source) {
+  Input              input(source.c_str(), source.size());
+  Lexer              lexer(input);
+  std::vector<Token> tokens;
+  do {
+    tokens.push_back(lexer.advance());
+  } while (tokens.back().type != Types::END);
+  return tokens;
+}
+
+// Compiles one statement at a time, a chunk only holds MAX_INSTRUCTIONS
+// bytes and function names repeat. With the IR each statement is lowered on
+// its own. Returns the bytes of bytecode produced.
+static size_t compile(Parser &parser) {
+  size_t code       = 0;
+  size_t statements = 0;
+  parser.advance();
+  while (parser.current_token->type != Types::END) {
+    parser.chunk.clear();
+    parser.parse_statement();
+    if (parser.optimization)
+      parser.flush();
+    code += static_cast<size_t>(parser.chunk.pos);
+    if (++statements % FRONTEND_SYMBOLS == 0)
+      parser.symbols = SymbolTable();
+  }
+  return code;
+}
+
+void bench_frontend() {
+  const Corpus corpora[] = {
+    {"expressions", expressions()},
+    {"functions", functions()},
+    {"strings", strings()},
+    {"numbers", numbers()},
+  };
+
+  for (const auto &corpus : corpora) {
+    const std::string &source = corpus.source;
+    const size_t       bytes  = source.size();
+    char               name[64];
+
+    // Lexing alone, every token kept
+    size_t tokens  = 0;
+    double seconds = bench_time(BENCH_RUNS, [&] {
+      tokens = lex(source).size();
+    });
+    snprintf(name, sizeof(name), "lexer %s", corpus.name);
+    bench_record({"frontend", name, seconds, bytes, tokens, 0});
+
+    // Parsing alone, over the tokens lexed above
+    const auto lexed = lex(source);
+    size_t     code  = 0;
+    seconds          = bench_time(BENCH_RUNS, [&] {
+      Input  input(source.c_str(), bytes);
+      Lexer  lexer(input);
+      Chunk  chunk;
+      Parser parser(lexer, chunk, lexed.data(), lexed.size());
+      code = compile(parser);
+    });
+    snprintf(name, sizeof(name), "parser %s", corpus.name);
+    bench_record({"frontend", name, seconds, bytes, tokens, code});
+
+    // Source to bytecode, the way the compiler runs
+    seconds = bench_time(BENCH_RUNS, [&] {
+      Input  input(source.c_str(), bytes);
+      Lexer  lexer(input);
+      Chunk  chunk;
+      Parser parser(lexer, chunk);
+      code = compile(parser);
+    });
+    snprintf(name, sizeof(name), "compile %s", corpus.name);
+    bench_record({"frontend", name, seconds, bytes, tokens, code});
+
+    // The same through the IR, every optimization on
+    seconds = bench_time(BENCH_RUNS, [&] {
+      Input  input(source.c_str(), bytes);
+      Lexer  lexer(input);
+      Chunk  chunk;
+      Parser parser(lexer, chunk);
+      parser.optimization = 2;
+      code                = compile(parser);
+    });
+    snprintf(name, sizeof(name), "compile -O2 %s", corpus.name);
+    bench_record({"frontend", name, seconds, bytes, tokens, code});
+  }
+}
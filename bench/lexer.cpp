@@ -0,0 +1,87 @@
+#include "bench.h"
+#include "lexer.h"
+#include "scan.h"
+
+#include <cstdio>
+#include <string>
+
+#define BENCH_SOURCE_SIZE 0x1000000UL // 16 MiB per corpus
+
+typedef struct Corpus {
+  const char *name;
+  std::string source;
+} Corpus;
+
+// Deeply indented statements, mostly whitespace and identifiers
+static std::string indented() {
+  std::string source;
+  for (int i = 0; source.size() < BENCH_SOURCE_SIZE; i++) {
+    source.append(static_cast<size_t>(4 * (i % 12)), ' ');
+    source += "accumulated_value_" + std::to_string(i % 97) +
+              " = previous_result_" + std::to_string(i % 89) + " + 1;\n";
+  }
+  return source;
+}
+
+static std::string strings() {
+  std::string source;
+  for (int i = 0; source.size() < BENCH_SOURCE_SIZE; i++) {
+    source += "\"lorem ipsum dolor sit amet, consectetur \\\"adipiscing\\\" "
+              "elit, sed do eiusmod tempor incididunt ut labore\"\n";
+  }
+  return source;
+}
+
+static std::string comments() {
+  std::string source;
+  for (int i = 0; source.size() < BENCH_SOURCE_SIZE; i++) {
+    source += "// line comment describing the next block in some detail\n"
+              "/* block comment\n * spanning several lines\n */ value\n";
+  }
+  return source;
+}
+
+// Non-ASCII names, strings and comments, everything goes through validation
+static std::string unicode() {
+  std::string source;
+  for (int i = 0; source.size() < BENCH_SOURCE_SIZE; i++) {
+    source += "größe_" + std::to_string(i % 97) +
+              " = \"überschrift 日本語 λόγος\" // заметка о значении\n";
+  }
+  return source;
+}
+
+static size_t lex(const std::string &source) {
+  Input  input(source.c_str());
+  Lexer  lexer(input);
+  size_t tokens = 0;
+  while (lexer.advance().type != Types::END) {
+    tokens++;
+  }
+  return tokens;
+}
+
+void bench_lexer() {
+  const Corpus corpora[] = {
+    {"indented", indented()},
+    {"strings", strings()},
+    {"comments", comments()},
+    {"unicode", unicode()},
+  };
+  const Scanner best = scanner;
+
+  for (const auto &corpus : corpora) {
+    for (const char *kernel : {"scalar", "sse2", "avx2"}) {
+      if (!use_scanner(kernel))
+        continue;
+      size_t       tokens  = 0;
+      const double seconds =
+        bench_time(BENCH_RUNS, [&] { tokens = lex(corpus.source); });
+      char name[64];
+      snprintf(name, sizeof(name), "%s (%s)", corpus.name, kernel);
+      bench_record(
+        {"lexer", name, seconds, corpus.source.size(), tokens, 0});
+    }
+  }
+  scanner = best;
+}
@@ -0,0 +1,99 @@
+#include "bench.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+typedef struct BenchSuite {
+  const char *name;
+  void (*run)();
+} BenchSuite;
+
+static const BenchSuite suites[] = {
+  {"file", bench_file},
+  {"lexer", bench_lexer},
+  {"number", bench_number},
+  {"tokenize", bench_tokenize},
+  {"document", bench_document},
+  {"frontend", bench_frontend},
+  {"build", bench_build},
+  {"symbol", bench_symbol},
+};
+
+static bool json    = false;
+static int  results = 0;
+
+static void print_json_string(const char *s) {
+  putchar('"');
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\')
+      putchar('\\');
+    putchar(*s);
+  }
+  putchar('"');
+}
+
+void bench_record(const BenchResult &result) {
+  const double per_second = 1 / result.seconds;
+  if (json) {
+    printf(results++ ? ",\n  {\"suite\": " : "  {\"suite\": ");
+    print_json_string(result.suite);
+    printf(", \"name\": ");
+    print_json_string(result.name);
+    printf(", \"seconds\": %.9f, \"bytes\": %zu, \"bytes_per_second\": %.0f",
+      result.seconds, result.bytes,
+      static_cast<double>(result.bytes) * per_second);
+    printf(", \"tokens\": %zu, \"tokens_per_second\": %.0f", result.tokens,
+      static_cast<double>(result.tokens) * per_second);
+    printf(", \"code\": %zu, \"code_per_second\": %.0f}", result.code,
+      static_cast<double>(result.code) * per_second);
+    return;
+  }
+  printf("%-8s %-28s %10.3f ms %10.1f MB/s", result.suite, result.name,
+    result.seconds * 1e3, static_cast<double>(result.bytes) * per_second / 1e6);
+  if (result.tokens)
+    printf(" %8.1f Mtok/s",
+      static_cast<double>(result.tokens) * per_second / 1e6);
+  if (result.code)
+    printf(" %8.1f MB/s code",
+      static_cast<double>(result.code) * per_second / 1e6);
+  putchar('\n');
+}
+
+void bench_report(const char *suite, const char *name, const double seconds,
+  const size_t bytes) {
+  bench_record({suite, name, seconds, bytes, 0, 0});
+}
+
+void bench_note(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vfprintf(json ? stderr : stdout, format, args);
+  va_end(args);
+}
+
+int main(const int argc, char *argv[]) {
+  int named = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--json") == 0)
+      json = true;
+    else
+      named++;
+  }
+
+  // Suites can be selected by name, all of them run by default
+  if (json)
+    printf("[\n");
+  for (const auto &suite : suites) {
+    bool selected = !named;
+    for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], suite.name) == 0)
+        selected = true;
+    }
+    if (selected)
+      suite.run();
+  }
+  if (json)
+    printf(results ? "\n]\n" : "]\n");
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include "bench.h"
+#include "lexer.h"
+#include "number.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#define BENCH_LITERALS 0x100000 // literals per corpus
+
+// Decimal literals as the lexer used to convert them: one pow call per
+// fractional digit and a final scaling by pow(10, exponent)
+static double legacy_decimal(const char *s, const size_t n) {
+  double value    = 0;
+  double exponent = 0;
+  int    float_idx = 0;
+  bool   had_float = false;
+  bool   had_exp   = false;
+  bool   exp_neg   = false;
+  for (size_t i = 0; i < n; i++) {
+    const char c = s[i];
+    if (c == '.') {
+      had_float = true;
+    } else if (c == 'e' || c == 'E') {
+      had_exp = true;
+      exp_neg = s[i + 1] == '-';
+      i += s[i + 1] == '-' || s[i + 1] == '+';
+    } else if (c >= '0' && c <= '9') {
+      if (had_exp)
+        exponent = exponent * 10 + (c - '0');
+      else if (had_float)
+        value += (c - '0') * (1.0 / pow(10, ++float_idx));
+      else
+        value = value * 10 + (c - '0');
+    }
+  }
+  return exp_neg ? value / pow(10, exponent) : value * pow(10, exponent);
+}
+
+typedef struct Literals {
+  std::string         source; // space separated, for the lexer
+  std::vector<size_t> offsets;
+} Literals;
+
+static Literals literals() {
+  Literals literals;
+  srand(42);
+  char buffer[64];
+  for (int i = 0; i < BENCH_LITERALS; i++) {
+    const double value = rand() / static_cast<double>(RAND_MAX) *
+                         pow(10, rand() % 40 - 20);
+    switch (i % 4) {
+      case 0:
+        snprintf(buffer, sizeof(buffer), "%d", rand());
+        break;
+      case 1:
+        snprintf(buffer, sizeof(buffer), "%.6f", value);
+        break;
+      case 2:
+        snprintf(buffer, sizeof(buffer), "%.17g", value);
+        break;
+      default:
+        snprintf(buffer, sizeof(buffer), "%.3e", value);
+    }
+    literals.offsets.push_back(literals.source.size());
+    literals.source += buffer;
+    literals.source += ' ';
+  }
+  return literals;
+}
+
+void bench_number() {
+  const Literals   corpus = literals();
+  const char      *source = corpus.source.c_str();
+  const size_t     bytes  = corpus.source.size();
+  volatile double  sink   = 0;
+
+  // Literal lengths are found up front so only the conversion is timed
+  std::vector<size_t> lengths;
+  for (const size_t offset : corpus.offsets)
+    lengths.push_back(corpus.source.find(' ', offset) - offset);
+
+  double seconds = bench_time(BENCH_RUNS, [&] {
+    for (size_t i = 0; i < lengths.size(); i++)
+      sink = sink + legacy_decimal(source + corpus.offsets[i], lengths[i]);
+  });
+  bench_report("number", "legacy (pow)", seconds, bytes);
+
+  seconds = bench_time(BENCH_RUNS, [&] {
+    for (size_t i = 0; i < lengths.size(); i++)
+      sink = sink + strtod(source + corpus.offsets[i], nullptr);
+  });
+  bench_report("number", "strtod", seconds, bytes);
+
+  seconds = bench_time(BENCH_RUNS, [&] {
+    for (size_t i = 0; i < lengths.size(); i++)
+      sink = sink + scan_number(source + corpus.offsets[i], lengths[i]).value;
+  });
+  bench_report("number", "scan_number", seconds, bytes);
+
+  seconds = bench_time(BENCH_RUNS, [&] {
+    Input input(source);
+    Lexer lexer(input);
+    while (lexer.advance().type != Types::END) {
+    }
+  });
+  bench_report("number", "lexer", seconds, bytes);
+
+  // strtod is correctly rounded, count how often each path disagrees
+  size_t legacy_errors = 0;
+  size_t scan_errors   = 0;
+  for (size_t i = 0; i < lengths.size(); i++) {
+    const char  *literal = source + corpus.offsets[i];
+    const double exact   = strtod(literal, nullptr);
+    legacy_errors += legacy_decimal(literal, lengths[i]) != exact;
+    scan_errors += scan_number(literal, lengths[i]).value != exact;
+  }
+  bench_note("number   inexact: legacy %zu, scan_number %zu of %zu literals\n",
+    legacy_errors, scan_errors, lengths.size());
+}
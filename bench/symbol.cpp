@@ -0,0 +1,138 @@
+#include "bench.h"
+#include "symbol.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define BENCH_SYMBOLS     1000000 // names inserted and looked up
+#define BENCH_SCOPE_SMALL 8       // locals of a typical function
+#define BENCH_SCOPE       0x40    // more than a table holds before it grows
+#define BENCH_SCOPE_NAMES 0x100000 // names declared across all scopes
+#define LEGACY_SIZE       0x100
+#define LEGACY_LEN        0x20
+
+// The table as it used to be: DJB2 into a fixed array, linear probing with
+// strncmp on every slot visited and names cut to fit inline
+typedef struct LegacySymbol {
+  bool in_use;
+  int  location;
+  char name[LEGACY_LEN];
+} LegacySymbol;
+
+typedef struct LegacyTable {
+  LegacySymbol table[LEGACY_SIZE];
+
+  LegacySymbol *entry(const char *name, size_t length) {
+    length      = length < LEGACY_LEN - 1 ? length : LEGACY_LEN - 1;
+    size_t hash = 5381;
+    for (size_t i = 0; i < length; i++)
+      hash = (hash << 5) + hash + name[i];
+    for (size_t i = 0; i < LEGACY_SIZE; i++) {
+      LegacySymbol *entry = &table[(hash + i) % LEGACY_SIZE];
+      if (!entry->in_use || (strncmp(entry->name, name, length) == 0 &&
+                              entry->name[length] == '\0'))
+        return entry;
+    }
+    return nullptr;
+  }
+} LegacyTable;
+
+static std::vector<std::string> names(const char *prefix, const int count) {
+  std::vector<std::string> names;
+  char                     buffer[64];
+  for (int i = 0; i < count; i++) {
+    snprintf(buffer, sizeof(buffer), "%s_%d", prefix, i);
+    names.emplace_back(buffer);
+  }
+  return names;
+}
+
+static size_t total(const std::vector<std::string> &names) {
+  size_t bytes = 0;
+  for (const std::string &name : names)
+    bytes += name.size();
+  return bytes;
+}
+
+void bench_symbol() {
+  const std::vector<std::string> present = names("symbol", BENCH_SYMBOLS);
+  const std::vector<std::string> absent  = names("missing", BENCH_SYMBOLS);
+  const size_t                   bytes   = total(present);
+  size_t                         found   = 0;
+  size_t                         missed  = 0;
+  size_t                         removed = 0;
+
+  SymbolTable table;
+  double      seconds = bench_time(BENCH_RUNS, [&] {
+    table = SymbolTable();
+    for (size_t i = 0; i < present.size(); i++)
+      table.insert(present[i].data(), present[i].size(), static_cast<int>(i),
+        SymbolType::F64);
+  });
+  bench_record({"symbol", "insert", seconds, bytes, 0, 0});
+
+  seconds = bench_time(BENCH_RUNS, [&] {
+    found = 0;
+    for (const std::string &name : present)
+      found += table.lookup(name.data(), name.size()) != nullptr;
+  });
+  bench_record({"symbol", "lookup hit", seconds, bytes, 0, 0});
+
+  seconds = bench_time(BENCH_RUNS, [&] {
+    missed = 0;
+    for (const std::string &name : absent)
+      missed += table.lookup(name.data(), name.size()) == nullptr;
+  });
+  bench_record({"symbol", "lookup miss", seconds, total(absent), 0, 0});
+
+  // Removing empties the table, so only one run is timed
+  seconds = bench_time(1, [&] {
+    for (const std::string &name : present)
+      removed += table.remove(name.data(), name.size());
+  });
+  bench_record({"symbol", "remove", seconds, bytes, 0, 0});
+  bench_note("symbol   %zu found, %zu missed, %zu removed of %zu, %zu left\n",
+    found, missed, removed, present.size(), table.size());
+
+  // Scopes small enough for the legacy table: declare every name, then look
+  // each of them up as the expressions of the scope would. Most scopes hold
+  // a few locals, the larger ones grow past the slots a table starts with.
+  volatile int sink = 0;
+  for (const int size : {BENCH_SCOPE_SMALL, BENCH_SCOPE}) {
+    const std::vector<std::string> scope = names("local", size);
+    const int    scopes = BENCH_SCOPE_NAMES / size;
+    const size_t scope_bytes = total(scope) * 2 * static_cast<size_t>(scopes);
+    char         name[64];
+
+    seconds = bench_time(BENCH_RUNS, [&] {
+      for (int i = 0; i < scopes; i++) {
+        LegacyTable legacy{};
+        for (size_t j = 0; j < scope.size(); j++) {
+          LegacySymbol *entry = legacy.entry(scope[j].data(), scope[j].size());
+          entry->in_use       = true;
+          entry->location     = static_cast<int>(j);
+          memcpy(entry->name, scope[j].data(), scope[j].size() + 1);
+        }
+        for (const std::string &local : scope)
+          sink = sink + legacy.entry(local.data(), local.size())->location;
+      }
+    });
+    snprintf(name, sizeof(name), "scopes of %d legacy (djb2)", size);
+    bench_record({"symbol", name, seconds, scope_bytes, 0, 0});
+
+    seconds = bench_time(BENCH_RUNS, [&] {
+      for (int i = 0; i < scopes; i++) {
+        SymbolTable locals;
+        for (size_t j = 0; j < scope.size(); j++)
+          locals.insert(scope[j].data(), scope[j].size(), static_cast<int>(j),
+            SymbolType::F64);
+        for (const std::string &local : scope)
+          sink = sink + locals.lookup(local.data(), local.size())->location;
+      }
+    });
+    snprintf(name, sizeof(name), "scopes of %d", size);
+    bench_record({"symbol", name, seconds, scope_bytes, 0, 0});
+  }
+}
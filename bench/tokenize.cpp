@@ -0,0 +1,98 @@
+#include "bench.h"
+#include "lexer.h"
+#include "tokenize.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+#define BENCH_SOURCE_SIZE 0x1000000UL // 16 MiB per corpus
+
+typedef struct Corpus {
+  const char *name;
+  std::string source;
+} Corpus;
+
+static std::string statements() {
+  std::string source;
+  for (int i = 0; source.size() < BENCH_SOURCE_SIZE; i++) {
+    source += "  result_" + std::to_string(i % 89) + " = " +
+              std::to_string(i) + ".25 * (\"text\" + offset) // note\n";
+  }
+  return source;
+}
+
+// Multi-line comments and strings with quotes inside, so that most split
+// points land where a fresh lexer would go wrong
+static std::string multiline() {
+  std::string source;
+  for (int i = 0; source.size() < BENCH_SOURCE_SIZE; i++) {
+    source += "/* it's a block comment\n   with \"quotes\" and `ticks\n */\n"
+              "`multi\nline ' string\n` + 1.5\n"
+              "...2 + value\n"
+              "'escaped \\\n newline' * 0x1F\n";
+  }
+  return source;
+}
+
+static bool same(const Token &a, const Token &b) {
+  return a.type == b.type && a.flags == b.flags && a.offset == b.offset &&
+         a.length == b.length && a.payload == b.payload;
+}
+
+static std::vector<Token> lex_serial(const std::string &source) {
+  Input              input(source.c_str());
+  Lexer              lexer(input);
+  std::vector<Token> tokens;
+  do {
+    tokens.push_back(lexer.advance());
+  } while (tokens.back().type != Types::END);
+  return tokens;
+}
+
+// Differential check against the serial lexer, any mismatch is fatal
+static void verify(const Corpus &corpus, const std::vector<Token> &expected,
+  const unsigned threads) {
+  const auto tokens =
+    tokenize(corpus.source.c_str(), corpus.source.size(), threads);
+  size_t i = 0;
+  while (i < tokens.size() && i < expected.size() &&
+         same(tokens[i], expected[i]))
+    i++;
+  if (i != tokens.size() || i != expected.size()) {
+    fprintf(stderr, "tokenize: %s with %u threads differs at token %zu\n",
+      corpus.name, threads, i);
+    exit(1);
+  }
+}
+
+void bench_tokenize() {
+  const Corpus corpora[] = {
+    {"statements", statements()},
+    {"multiline", multiline()},
+  };
+  unsigned threads = std::thread::hardware_concurrency();
+  if (!threads)
+    threads = 1;
+
+  for (const auto &corpus : corpora) {
+    const auto expected = lex_serial(corpus.source);
+    for (const unsigned count : {1U, 2U, 7U, 16U, threads})
+      verify(corpus, expected, count);
+
+    const size_t bytes   = corpus.source.size();
+    double       seconds = bench_time(BENCH_RUNS, [&] {
+      lex_serial(corpus.source);
+    });
+    char name[64];
+    snprintf(name, sizeof(name), "%s (serial)", corpus.name);
+    bench_report("tokenize", name, seconds, bytes);
+
+    seconds = bench_time(BENCH_RUNS, [&] {
+      tokenize(corpus.source.c_str(), bytes, threads);
+    });
+    snprintf(name, sizeof(name), "%s (%u threads)", corpus.name, threads);
+    bench_report("tokenize", name, seconds, bytes);
+  }
+}
@@ -0,0 +1,13 @@
+#ifndef HADRON_BUILD_H
+#define HADRON_BUILD_H 1
+
+#include <cstddef>
+
+// Compiles every .hdn file under `dir` into a .hbc next to it. Sources are
+// shared out to `threads` workers, each with its own arena, parser and
+// symbol tables, so nothing is shared but the list of sources. With fewer
+// sources than threads the others lex the large ones. Returns the files
+// compiled.
+size_t build(const char *dir, int optimization, unsigned threads);
+
+#endif // HADRON_BUILD_H
@@ -0,0 +1,76 @@
+#ifndef HADRON_BUNDLE_H
+#define HADRON_BUNDLE_H 1
+
+#include "file.h"
+#include "vm.h"
+
+#include <vector>
+
+// A bundle packs many compiled modules into one file:
+//
+//   BundleHeader | BundleEntry[slots] | names | code | line tables
+//
+// The entries form an open-addressed hash index over the module names, so a
+// module can be found and materialized without touching any other module.
+
+typedef struct BundleHeader {
+  char     magic[FILE_HEADER_MAGIC_SIZE];
+  uint8_t  major;
+  uint8_t  minor;
+  uint16_t flags;
+  uint32_t count; // modules in the bundle
+  uint32_t slots; // index capacity, a power of two
+  uint32_t entry; // index slot of the module run by default
+  uint32_t reserved;
+} BundleHeader;
+
+typedef struct BundleEntry {
+  uint32_t hash;
+  uint32_t name;        // offset from the start of the bundle
+  uint32_t name_length; // 0 marks an empty slot
+  uint32_t code;
+  uint32_t code_length;
+  uint32_t lines;
+  uint32_t lines_length;
+} BundleEntry;
+
+class Bundle {
+  const uint8_t      *data{nullptr};
+  size_t              size{0};
+  const BundleHeader *header{nullptr};
+  const BundleEntry  *index{nullptr};
+
+  // Whether the name of `entry` lies within the bundle
+  [[nodiscard]] bool has_name(const BundleEntry *entry) const;
+
+  public:
+  explicit Bundle(File &file);
+
+  [[nodiscard]] const BundleEntry *find(const char *name, size_t length) const;
+  [[nodiscard]] const BundleEntry *entry() const;
+  [[nodiscard]] uint32_t           count() const { return header->count; }
+
+  // Copies the name of `entry` terminated into `name`, fails if it does not
+  // fit `capacity` bytes or lies outside the bundle
+  bool get_name(const BundleEntry *entry, char *name, size_t capacity) const;
+  bool load(const BundleEntry *entry, Chunk &chunk) const;
+};
+
+class BundleWriter {
+  typedef struct Module {
+    std::vector<char>    name;
+    std::vector<uint8_t> code;
+    std::vector<uint8_t> lines;
+  } Module;
+
+  std::vector<Module> modules{};
+
+  public:
+  void add(const char *name, const Chunk &chunk);
+
+  [[nodiscard]] FileResult write(const char *file_name);
+};
+
+uint32_t bundle_hash(const char *name, size_t length);
+
+#endif // HADRON_BUNDLE_H
@@ -0,0 +1,104 @@
+#ifndef HADRON_DOCUMENT_H
+#define HADRON_DOCUMENT_H 1
+
+#include "gap.h"
+#include "lexer.h"
+#include "symbol.h"
+#include "types.h"
+#include "vm.h"
+
+#include <string>
+#include <vector>
+
+// A call to a function of any statement, which linking points at it
+typedef struct DocumentCall {
+  uint32_t    at; // of the call in the code of its statement
+  std::string name;
+} DocumentCall;
+
+// A top-level statement and the code it compiles to
+typedef struct DocumentUnit {
+  size_t                    first; // index of its first token
+  size_t                    count; // tokens it spans
+  int                       line;  // of its first token when it was compiled
+  std::vector<uint8_t>      code;
+  std::vector<uint8_t>      lines; // encoded line table
+  std::vector<DocumentCall> calls;
+  // Slots taken and functions defined by the script once it has run
+  uint32_t                  locals;
+  uint32_t                  functions;
+} DocumentUnit;
+
+struct TokenPlace {
+  static size_t position(const Token &token) { return token.offset; }
+  static void   flip(Token &token, const size_t end) {
+    token.offset = static_cast<uint32_t>(end - token.offset);
+  }
+};
+
+struct UnitPlace {
+  static size_t position(const DocumentUnit &unit) { return unit.first; }
+  static void   flip(DocumentUnit &unit, const size_t end) {
+    unit.first = end - unit.first;
+  }
+};
+
+// A local of the script, which statements after its declaration can use
+typedef struct DocumentLocal {
+  std::string name;
+  uint32_t    slot;
+  SymbolType  type;
+} DocumentLocal;
+
+// A function of the script, where the code of its statement has it
+typedef struct DocumentFunction {
+  std::string name;
+  uint32_t    location;
+  uint8_t     arity;
+} DocumentFunction;
+
+// A source kept compiled across edits, for editors. An edit re-lexes from the
+// last token it cannot affect until the new tokens line up with the old ones
+// again, then re-parses only the statements those tokens belong to, and
+// those after them until the script has the same locals and functions again.
+// Calls between statements are only pointed at their functions when the
+// statements are linked, so statements that grow move nothing. Text, lines,
+// tokens and statements are kept in gap lists, which are moved to the edit,
+// so that nothing after the statements parsed again has to be touched. The
+// text gap then goes back to the statement before the edit, the text after
+// it is read in place.
+class Document {
+  GapList<char, Unplaced>          text;
+  LineIndex                        lines;
+  GapList<Token, TokenPlace>       tokens; // ends with the END token
+  GapList<DocumentUnit, UnitPlace> units;
+  std::vector<DocumentLocal>       locals;    // by slot
+  std::vector<DocumentFunction>    functions; // in the order they are defined
+
+  [[nodiscard]] Token  token(size_t index) const;
+  [[nodiscard]] size_t unit_first(size_t index) const;
+
+  void resume(Lexer &lexer, size_t next) const;
+  void relex(size_t offset, size_t length, size_t keep);
+  void reparse(size_t unit, size_t start, size_t first, size_t count);
+
+  public:
+  size_t relexed{0};  // tokens lexed by the last edit
+  size_t reparsed{0}; // statements parsed by the last edit
+
+  Document(const char *source, size_t length);
+
+  // Replaces `removed` bytes at `offset` with `length` bytes of `inserted`
+  void edit(size_t offset, size_t removed, const char *inserted, size_t length);
+
+  // Joins the code of every statement into one runnable chunk
+  void link(Chunk &chunk) const;
+
+  // Copies of the whole document, for tools and checks
+  [[nodiscard]] std::string               source() const;
+  [[nodiscard]] std::vector<Token>        token_list() const;
+  [[nodiscard]] std::vector<DocumentUnit> unit_list() const;
+  [[nodiscard]] const LineIndex &line_index() const { return lines; }
+};
+
+#endif // HADRON_DOCUMENT_H
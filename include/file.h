@@ -7,6 +7,7 @@
 #include "util.h"
 
 #include <cstdio>
+#include <sys/uio.h>
 
 typedef enum __attribute__((__packed__)) FileMode {
   FILE_MODE_NONE,
@@ -20,11 +21,14 @@ typedef enum __attribute__((__packed__)) FileResult {
   FILE_READ_DONE,
   FILE_READ_FAILURE,
   FILE_WRITE_FAILURE,
+  FILE_MAP_FAILURE,
 } FileResult;
 
 #define FILE_HEADER_MAGIC_SIZE 4
 #define MAX_WRITE_LENGTH       0x1000
 
+#define FILE_FLAG_LINES 0x01 // a line table section follows the code
+
 typedef struct FileHeader {
   char    magic[FILE_HEADER_MAGIC_SIZE];
   uint8_t major;
@@ -33,10 +37,25 @@ typedef struct FileHeader {
   uint8_t name;
 } FileHeader;
 
+// Since 0.2 the name is followed by sections instead of the bare code
+typedef enum __attribute__((__packed__)) FileSectionType {
+  FILE_SECTION_CODE = 1,
+  FILE_SECTION_LINES,
+  FILE_SECTION_EXPORTS, // functions other modules can call
+  FILE_SECTION_IMPORTS, // functions of other modules called
+} FileSectionType;
+
+typedef struct FileSection {
+  uint8_t  type;
+  uint8_t  reserved[3];
+  uint32_t size;
+} FileSection;
+
 class File {
   uint8_t buffer[CHUNK_SIZE]{};
 
   FILE       *fp{nullptr};
+  void       *mapping{nullptr};
   const char *file_name{nullptr};
   size_t      file_size{0};
   size_t      buffer_size{0};
@@ -64,36 +83,30 @@ class File {
   FileResult lookup_byte(char *pc) const;
   FileResult current_byte(char *pc) const;
   FileResult read_chunk(char *buffer, size_t start, size_t length) const;
+  // Maps the whole file read-only, the mapping lives as long as the File
+  FileResult map(const uint8_t **data, size_t *size);
 
-  [[nodiscard]] FileResult write_header() const;
+  void fill_header(FileHeader *header) const;
+
+  [[nodiscard]] FileResult write_header();
   [[nodiscard]] FileResult read_header(FileHeader *header);
   [[nodiscard]] FileResult read_name(char *name, size_t length);
+  [[nodiscard]] FileResult read_section(FileSection *section);
+  [[nodiscard]] FileResult read_data(void *data, size_t length);
+  [[nodiscard]] FileResult skip(size_t length);
+
+  // Buffers small spans, spans larger than the buffer go straight to the file
+  FileResult write(const void *data, size_t length);
+  // Writes all vectors with as few syscalls as possible. The vectors are
+  // advanced in place on partial writes.
+  FileResult write_vectored(iovec *vectors, int count);
 
   template <typename T> FileResult write(T value) {
-    if (mode != FILE_MODE_WRITE) {
-      return FILE_MODE_INVALID;
-    }
-    if constexpr (std::is_same_v<T, char *>) {
-      const size_t length = h_strnlen(value, MAX_WRITE_LENGTH);
-      if (buffer_size + length >= CHUNK_SIZE) {
-        if (const FileResult res = write_flush(); res != FILE_STATUS_OK) {
-          return res;
-        }
-      }
-      if (const size_t write_size = fwrite(value, 1, length, fp);
-          write_size != length) {
-        return FILE_WRITE_FAILURE;
-      }
-      return FILE_STATUS_OK;
+    if constexpr (std::is_same_v<T, char *> ||
+                  std::is_same_v<T, const char *>) {
+      return write(value, h_strnlen(value, MAX_WRITE_LENGTH));
     } else {
-      if (buffer_size + sizeof(value) == CHUNK_SIZE) {
-        if (const FileResult res = write_flush(); res != FILE_STATUS_OK) {
-          return res;
-        }
-      }
-      buffer[buffer_size] = static_cast<uint8_t>(value);
-      buffer_size += sizeof(value);
-      return FILE_STATUS_OK;
+      return write(&value, sizeof(value));
     }
   }
 
@@ -0,0 +1,132 @@
+#ifndef HADRON_GAP_H
+#define HADRON_GAP_H 1
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+// Items in order with a gap where they were last edited. Past the gap items
+// keep their position as the distance to `end`, the size of what positions
+// point into, so edits at the gap move them without touching them. Moving
+// the gap costs as much as the items it passes. `Place` tells where the
+// position of an item is, and flips it between both ways of keeping it.
+template <typename T, typename Place> class GapList {
+  std::vector<T> items; // `spare` unused ones at `gap`
+  size_t         gap{0};
+  size_t         spare{0};
+
+  [[nodiscard]] size_t slot(const size_t index) const {
+    return index < gap ? index : index + spare;
+  }
+
+  public:
+  GapList() = default;
+  explicit GapList(std::vector<T> &&all)
+    : items(std::move(all)), gap(items.size()) {}
+
+  [[nodiscard]] size_t size() const { return items.size() - spare; }
+  // Index of the first item past the gap
+  [[nodiscard]] size_t split() const { return gap; }
+
+  // Item `index` as it is kept, its position may be relative
+  [[nodiscard]] const T &stored(const size_t index) const {
+    return items[slot(index)];
+  }
+  [[nodiscard]] T at(const size_t index, const size_t end) const {
+    T item = items[slot(index)];
+    if (index >= gap)
+      Place::flip(item, end);
+    return item;
+  }
+  [[nodiscard]] size_t position(const size_t index, const size_t end) const {
+    const size_t kept = Place::position(items[slot(index)]);
+    return index < gap ? kept : end - kept;
+  }
+  // Items from the gap on lie one after another, indexed as in the list
+  [[nodiscard]] const T *tail() const { return items.data() + spare; }
+
+  void move(const size_t to, const size_t end) {
+    while (gap > to) {
+      gap--;
+      if (spare)
+        items[gap + spare] = std::move(items[gap]);
+      Place::flip(items[gap + spare], end);
+    }
+    while (gap < to) {
+      if (spare)
+        items[gap] = std::move(items[gap + spare]);
+      Place::flip(items[gap], end);
+      gap++;
+    }
+  }
+  // Drops `count` items right after the gap
+  void erase(const size_t count) { spare += count; }
+  // Adds items right before the gap, with their positions
+  template <typename It> void insert(It first, const It last) {
+    const auto length = static_cast<size_t>(std::distance(first, last));
+    if (length > spare) {
+      // A larger gap, so that growing stays linear over many edits
+      const size_t   more = length - spare + size() / 4 + 0x10;
+      std::vector<T> grown(items.size() + more);
+      std::move(items.begin(), items.begin() + static_cast<long>(gap),
+        grown.begin());
+      std::move(items.begin() + static_cast<long>(gap + spare), items.end(),
+        grown.begin() + static_cast<long>(gap + spare + more));
+      items = std::move(grown);
+      spare += more;
+    }
+    for (; first != last; ++first, gap++, spare--)
+      items[gap] = *first;
+  }
+
+  [[nodiscard]] std::vector<T> list(const size_t end) const {
+    std::vector<T> all;
+    all.reserve(size());
+    for (size_t i = 0; i < size(); i++)
+      all.push_back(at(i, end));
+    return all;
+  }
+};
+
+// First index of [first, last) that `before` is false for, it is true for
+// every index ahead of that one
+template <typename Pred>
+size_t partition_index(size_t first, size_t last, Pred before) {
+  while (first < last) {
+    const size_t middle = first + (last - first) / 2;
+    if (before(middle))
+      first = middle + 1;
+    else
+      last = middle;
+  }
+  return first;
+}
+
+// The same, looking around `near` first in steps that double. Lookups close
+// to the last edit then stay among the items around it.
+template <typename Pred>
+size_t partition_index(
+  size_t first, size_t last, const size_t near, Pred before) {
+  size_t step = 1;
+  if (near < last && before(near)) {
+    first = near + 1;
+    for (; step < last - first && before(first + step - 1); step *= 2)
+      first += step;
+    last = std::min(last, first + step);
+  } else if (near > first) {
+    last = std::min(last, near);
+    for (; step < last - first && !before(last - step); step *= 2)
+      last -= step;
+    first = last - std::min(step, last - first);
+  }
+  return partition_index(first, last, before);
+}
+
+// For items without a position, such as the bytes of a text
+struct Unplaced {
+  template <typename T> static void flip(T &, size_t) {}
+};
+
+#endif // HADRON_GAP_H
@@ -5,8 +5,9 @@
 
 #define MAX_ALLOCATIONS 0x800UL
 
-static uint8_t alloc_buffer[MAX_ALLOCATIONS]{};
-static size_t  allocations = 0;
+// Every thread allocates from an arena of its own
+inline thread_local uint8_t alloc_buffer[MAX_ALLOCATIONS]{};
+inline thread_local size_t  allocations = 0;
 
 inline void *halloc(const size_t size) {
   // Avoiding dynamic allocations
@@ -15,11 +16,10 @@ inline void *halloc(const size_t size) {
   if (allocations > MAX_ALLOCATIONS) {
     Logger::fatal("Too many allocations");
   }
-  char message[96];
-  snprintf(message, 96, "Allocating %3lu bytes. Remaining %4lu", size,
-    MAX_ALLOCATIONS - allocations);
-  Logger::warn(message);
   return ptr;
 }
 
+// Frees everything the thread allocated at once
+inline void hreset() { allocations = 0; }
+
 #endif // HADRON_HALLOC_H
@@ -6,6 +6,7 @@
 enum class InputType : uint8_t {
   FILE,
   STRING,
+  MAPPED, // the whole file mapped as one read-only buffer
 };
 
 static File def;
@@ -21,8 +22,11 @@ class Input {
 
   public:
   explicit Input(File &file) : type(InputType::FILE), file(file) {}
+  Input(File &file, InputType type);
   explicit Input(const char *source)
     : type(InputType::STRING), length(h_strlen(source)), source(source) {}
+  Input(const char *source, const size_t length)
+    : type(InputType::STRING), length(length), source(source) {}
   Input &operator=(const Input &input) {
     if (this == &input)
       return *this;
@@ -39,7 +43,14 @@ class Input {
   char               next();
   [[nodiscard]] char peek() const;
   [[nodiscard]] char current() const;
+  // Contiguous sources only: the whole buffer, and moving the read position
+  [[nodiscard]] const char *data() const {
+    return type == InputType::FILE ? nullptr : source;
+  }
+  [[nodiscard]] size_t size() const { return length; }
+  void                 seek(const size_t position) { index = position; }
   void               read_chunk(char *dest, size_t start, size_t length) const;
+  [[nodiscard]] const char *view(size_t start, size_t length) const;
 };
 
 #endif // HADRON_INPUT_H
@@ -0,0 +1,95 @@
+#ifndef HADRON_IR_H
+#define HADRON_IR_H 1
+
+#include "types.h"
+#include "vm.h"
+
+#include <cstdint>
+#include <vector>
+
+// Values are numbered by the instruction defining them
+#define IR_NONE UINT32_MAX
+// Instructions a function body can have and still be inlined
+#define IR_INLINE_BUDGET 16
+
+// One instruction per bytecode operation, with its operands spelled out
+// instead of implied by the VM stack. MOVE defines a constant, LOAD the value
+// of a local on entry, which is in the slot of its index like the parameters
+// the call left in the first slots. STORE ends a block, see close().
+typedef struct IrInstr {
+  OpCode   op;
+  uint32_t offset{0};                 // of its token in the source
+  uint32_t args[2]{IR_NONE, IR_NONE}; // operand values
+  Any      value{};                   // MOVE: f64, LOAD: u32 slot,
+                                      // CALL: slice, CALL_EXT: u32 import
+} IrInstr;
+
+static_assert(sizeof(IrInstr) == 24, "Instructions are meant to stay compact");
+
+// Operands of an instruction, in the order they are pushed
+template <typename T> struct IrOperands {
+  T *first;
+  T *last;
+
+  [[nodiscard]] T *begin() const { return first; }
+  [[nodiscard]] T *end() const { return last; }
+};
+
+// The code of a function, or of the top-level script, in SSA form. The parse
+// rules hand over operations in the order the stack machine runs them,
+// `stack` tracks which values they leave on the VM stack so that operands
+// can be named. Locals are not stored anywhere, they name the value last
+// assigned to them.
+//
+// Code that jumps is split into blocks, which are lowered one at a time.
+// Between blocks the values on the stack stay there and each local is in the
+// slot of its index.
+class IrFunction {
+  public:
+  std::vector<IrInstr>  instrs;   // indexed by value
+  std::vector<uint32_t> order;    // instructions in execution order
+  std::vector<uint32_t> operands; // of calls, which take any number
+  std::vector<uint32_t> stack;    // values not consumed yet
+  std::vector<uint32_t> locals;   // value of each local
+  std::vector<uint32_t> homes;    // slots of the locals the block stores
+  uint32_t              params{0};
+
+  uint32_t add(OpCode op, uint32_t offset);
+  uint32_t constant(double value, uint32_t offset);
+  uint32_t load(uint32_t slot, uint32_t offset);
+  uint32_t param(uint32_t offset);
+  // Calls take `argc` operands, those missing were left on the VM stack by an
+  // earlier statement and come first as IR_NONE
+  uint32_t call(OpCode op, Any callee, uint32_t argc, uint32_t offset);
+  // Ends the block with a STORE taking the values left on the stack, which
+  // stay there, then those of the locals assigned in the block, which go to
+  // their `homes`. A block that returned has nothing to hand over.
+  void     close(uint32_t offset);
+  void     clear();
+
+  IrOperands<uint32_t>       operands_of(uint32_t id);
+  IrOperands<const uint32_t> operands_of(uint32_t id) const;
+};
+
+// Operands an operation takes from the stack
+int ir_arity(OpCode op);
+// Whether an operation leaves a value on the stack
+bool ir_defines(OpCode op);
+// Calls and block ends, whose operands are kept in IrFunction::operands
+bool ir_variadic(OpCode op);
+// Pure operations only depend on their operands and can neither fail nor be
+// observed, so they can be folded, merged, moved and removed
+bool ir_pure(OpCode op);
+
+// Why the optimized `body` of a function cannot be inlined, null if it can
+const char *ir_inline_blocker(const IrFunction &body);
+// Copies `body` into `function` in place of a call to it, its parameters
+// name the `argc` values on top of the stack and its result is left there
+void ir_inline(IrFunction &function, const IrFunction &body, uint32_t argc,
+  uint32_t offset);
+
+// -O1 folds constants and removes dead code, -O2 also merges common
+// subexpressions
+void optimize(IrFunction &function, int level);
+
+#endif // HADRON_IR_H
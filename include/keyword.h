@@ -0,0 +1,124 @@
+#ifndef HADRON_KEYWORD_H
+#define HADRON_KEYWORD_H 1
+
+#include "types.h"
+
+#include <cstddef>
+#include <cstring>
+
+// The keyword set. Adding a keyword only takes a new line here, the perfect
+// hash below is recomputed by the compiler.
+constexpr struct {
+  const char *name;
+  Type        type;
+} keywords[] = {
+  {"as", Types::AS},
+  {"async", Types::ASYNC},
+  {"await", Types::AWAIT},
+  {"case", Types::CASE},
+  {"class", Types::CLASS},
+  {"default", Types::DEFAULT},
+  {"do", Types::DO},
+  {"else", Types::ELSE},
+  {"false", Types::FALSE},
+  {"for", Types::FOR},
+  {"from", Types::FROM},
+  {"fx", Types::FX},
+  {"if", Types::IF},
+  {"import", Types::IMPORT},
+  {"in", Types::IN},
+  {"new", Types::NEW},
+  {"null", Types::NUL},
+  {"return", Types::RETURN},
+  {"select", Types::SELECT},
+  {"switch", Types::SWITCH},
+  {"true", Types::TRUE},
+  {"while", Types::WHILE},
+};
+
+#define KEYWORD_BITS  6
+#define KEYWORD_SLOTS (1U << KEYWORD_BITS)
+
+constexpr size_t keyword_length(const char *name) {
+  size_t length = 0;
+  while (name[length])
+    length++;
+  return length;
+}
+
+constexpr size_t keyword_length_bound(const bool longest) {
+  size_t bound = keyword_length(keywords[0].name);
+  for (const auto &keyword : keywords) {
+    const size_t length = keyword_length(keyword.name);
+    if (longest ? length > bound : length < bound)
+      bound = length;
+  }
+  return bound;
+}
+
+constexpr size_t MIN_KEYWORD_LENGTH = keyword_length_bound(false);
+constexpr size_t MAX_KEYWORD_LENGTH = keyword_length_bound(true);
+
+// First, second and last character plus the length tell all keywords apart,
+// a multiplicative hash then spreads these keys over the slots
+constexpr uint32_t keyword_slot(
+  const char *s, const size_t length, const uint32_t seed) {
+  const uint32_t key = static_cast<uint8_t>(s[0]) |
+                       static_cast<uint8_t>(s[length > 1]) << 8 |
+                       static_cast<uint8_t>(s[length - 1]) << 16 |
+                       static_cast<uint32_t>(length) << 24;
+  return key * seed >> (32 - KEYWORD_BITS);
+}
+
+constexpr uint32_t find_keyword_seed() {
+  for (uint32_t seed = 0x9E3779B1; seed != 0x9E3779B1 + 0x20000; seed += 2) {
+    uint64_t used      = 0;
+    bool     collision = false;
+    for (const auto &keyword : keywords) {
+      const uint32_t slot =
+        keyword_slot(keyword.name, keyword_length(keyword.name), seed);
+      collision |= (used >> slot & 1) != 0;
+      used |= 1ULL << slot;
+    }
+    if (!collision)
+      return seed;
+  }
+  return 0;
+}
+
+constexpr uint32_t keyword_seed = find_keyword_seed();
+static_assert(keyword_seed, "No perfect hash found, increase KEYWORD_BITS");
+
+typedef struct KeywordTable {
+  struct {
+    const char *name;
+    size_t      length; // 0 for empty slots
+    Type        type;
+  } slots[KEYWORD_SLOTS];
+} KeywordTable;
+
+constexpr KeywordTable build_keyword_table() {
+  KeywordTable table{};
+  for (const auto &keyword : keywords) {
+    const size_t   length = keyword_length(keyword.name);
+    const uint32_t index  = keyword_slot(keyword.name, length, keyword_seed);
+    table.slots[index].name   = keyword.name;
+    table.slots[index].length = length;
+    table.slots[index].type   = keyword.type;
+  }
+  return table;
+}
+
+constexpr KeywordTable keyword_table = build_keyword_table();
+
+// One hash, one length check and one memcmp against the source
+inline Type keyword(const char *s, const size_t length) {
+  if (length < MIN_KEYWORD_LENGTH || length > MAX_KEYWORD_LENGTH)
+    return Types::NAME;
+  const auto &slot = keyword_table.slots[keyword_slot(s, length, keyword_seed)];
+  if (slot.length == length && memcmp(slot.name, s, length) == 0)
+    return slot.type;
+  return Types::NAME;
+}
+
+#endif // HADRON_KEYWORD_H
@@ -4,16 +4,19 @@
 #include "input.h"
 
 class Lexer {
-  bool   end{false};
-  bool   had_float{false}; // State-tracking for range operator parsing
-  char   current_char{'\0'};
-  char   next_char{'\0'};
-  int    iterator{-1};
-  int    character{1};
-  int    line{1};
-  int    start{0};
-  int    absStart{0};
-  Input &input;
+  bool     end{false};
+  bool     had_float{false}; // State-tracking for range operator parsing
+  bool     soft_errors{false};
+  bool     failed{false};
+  uint32_t constant_index{0};
+  char     current_char{'\0'};
+  char     next_char{'\0'};
+  int      iterator{-1};
+  int      absStart{0};
+  uint32_t newlines{0};    // consumed so far
+  uint32_t token_lines{0}; // consumed before the current token started
+  uint32_t last_lines{0};  // consumed before the previous token started
+  Input   &input;
 
   char               next();
   [[nodiscard]] char current() const;
@@ -21,9 +24,18 @@ class Lexer {
   [[nodiscard]] char peek2() const;
   [[nodiscard]] bool match(char c);
 
+  void skip(size_t count);
+  void skip_space();
+  void skip_ident();
+  void skip_until(char a, char b, char c);
+
+  [[nodiscard]] size_t decode(size_t offset, uint32_t *code_point) const;
+  [[nodiscard]] bool   valid_utf8(size_t from, size_t to) const;
+
   [[nodiscard]] Token emit(Type type);
-  [[nodiscard]] Token emit(Type type, double value) const;
-  [[nodiscard]] Token number(char first_char);
+  [[nodiscard]] Token number();
+  [[nodiscard]] Token identifier(bool ascii);
+  [[nodiscard]] Token fail(const char *message);
 
   public:
   explicit Lexer(Input &input) : input(input) {
@@ -31,6 +43,35 @@ class Lexer {
   }
   void  reset(const Input &input);
   Token advance();
+
+  // Moves to `offset`, contiguous sources only. Resuming right after a token
+  // also needs whether it was a number with a '.' in it and whether a line
+  // break lies between its start and `offset`.
+  void seek(size_t offset, bool after_float = false, bool after_break = false);
+
+  // Speculative lexing: errors end the stream instead of the process
+  void set_soft_errors(const bool soft) { soft_errors = soft; }
+  [[nodiscard]] bool has_failed() const { return failed; }
+
+  // The only state carried from one token to the next, it only depends on
+  // the previous token
+  [[nodiscard]] bool carries_float() const { return had_float; }
+
+  // Size of a contiguous source, 0 when it is streamed from a file
+  [[nodiscard]] size_t source_size() const {
+    return input.data() ? input.size() : 0;
+  }
+
+  [[nodiscard]] const Input &source() const { return input; }
+
+  // Text of a NAME or STR token, pointing into the source when possible
+  [[nodiscard]] const char *view(const Token &token) const {
+    const Slice text = token_text(token);
+    return input.view(text.offset, text.length);
+  }
+
+  // Value of a number token, scanned again from the source
+  [[nodiscard]] double value(const Token &token) const;
 };
 
 #endif // HADRON_LEXER_H
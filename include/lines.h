@@ -0,0 +1,72 @@
+#ifndef HADRON_LINES_H
+#define HADRON_LINES_H 1
+
+#include "gap.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Input;
+
+#define MAX_LINE_TABLE 0x800
+
+// Maps bytecode offsets to source positions. Only instructions whose position
+// differs from the previous one get an entry, each entry being three LEB128
+// varints: the pc delta, the zigzag encoded line delta and the column. The
+// table is only decoded when a position is actually needed.
+class LineTable {
+  int last_entry{0}; // offset of the newest entry
+  int base_pc{0};    // position the newest entry is relative to
+  int base_line{0};
+  int last_pc{0};
+  int last_line{0};
+  int last_column{-1};
+
+  public:
+  int     size{0};
+  uint8_t data[MAX_LINE_TABLE]{};
+
+  void add(int pc, int line, int column);
+  bool load(const uint8_t *table, size_t length);
+  void clear();
+  // Adds every entry of an encoded table, moved by `pc_offset` and
+  // `line_offset`
+  void append(
+    const uint8_t *table, size_t length, int pc_offset, int line_offset);
+
+  [[nodiscard]] bool find(int pc, int *line, int *column) const;
+};
+
+struct LinePlace {
+  static size_t position(const uint32_t start) { return start; }
+  static void   flip(uint32_t &start, const size_t end) {
+    start = static_cast<uint32_t>(end - start);
+  }
+};
+
+// Offsets at which the lines of a source start, found in one pass over the
+// source so that tokens only need to keep their offset. Positions are looked
+// up when diagnostics or debug info ask for them, mostly in source order.
+// Edits only move the starts between them and the previous edit.
+class LineIndex {
+  GapList<uint32_t, LinePlace> starts{std::vector<uint32_t>{0}};
+  size_t                       end{0};  // size of the source
+  mutable size_t               hint{0}; // line of the previous lookup
+
+  [[nodiscard]] size_t start(const size_t line) const {
+    return starts.position(line, end);
+  }
+
+  public:
+  void build(const char *source, size_t length);
+  void build(const Input &input);
+  // Follows an edit of the source the index was built from
+  void edit(size_t offset, size_t removed, const char *inserted, size_t length);
+
+  // 1-based line and column of the byte at `offset`
+  void locate(size_t offset, int *line, int *column) const;
+  [[nodiscard]] int line(size_t offset) const;
+};
+
+#endif // HADRON_LINES_H
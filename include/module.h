@@ -0,0 +1,73 @@
+#ifndef HADRON_MODULE_H
+#define HADRON_MODULE_H 1
+
+#include "file.h"
+#include "vm.h"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Module;
+
+// A top-level function other modules can call. Exports are numbered by
+// their slot in the table, which importers look up by name once.
+typedef struct ModuleExport {
+  std::string name;
+  int         location; // of the body in the module's code
+  uint8_t     arity;
+} ModuleExport;
+
+// A function of another module, code calls it through the import slot of
+// its index
+typedef struct ModuleImport {
+  std::string module;
+  std::string name;
+} ModuleImport;
+
+// An import slot once resolved, on the first call through it
+typedef struct ModuleLink {
+  Module  *module{nullptr};
+  uint32_t slot{0}; // in the export table of `module`
+} ModuleLink;
+
+class Module {
+  public:
+  std::string               name;
+  std::string               dir; // where the modules it imports are found
+  Chunk                     chunk;
+  std::vector<ModuleExport> exports;
+  std::vector<ModuleImport> imports;
+  std::vector<ModuleLink>   links; // one per import, filled in lazily
+};
+
+// Compiles the source `file` into `module`, logging what became of each
+// call at -O2 if asked to. Sources of LEX_PARALLEL_SOURCE bytes or more are
+// lexed on `threads` threads first.
+void compile_module(File &file, Module &module, int optimization,
+  unsigned threads, bool report_inlining = false);
+// Reads a .hbc file, written by any version
+void read_module(File &file, Module &module);
+// Writes `module` next to its source `file`, as a .hbc of the same name
+void write_module(const File &file, const Module &module);
+
+// Modules compiled or read so far, shared by everything importing them. A
+// module is only loaded once code calls into it. Its .hbc is used unless the
+// source is newer, a source compiled here leaves a .hbc behind for the next
+// run.
+class ModuleCache {
+  std::unordered_map<std::string, std::unique_ptr<Module>> modules;
+
+  public:
+  int optimization{0}; // for sources compiled on the way
+
+  // The module `name` in the directory `dir`
+  Module *load(const std::string &dir, const std::string &name);
+  // The module read from the .hbc `path`, which is what is run
+  Module *open(const char *path);
+  // Resolves import `slot` of `module` to the export it names
+  const ModuleLink &link(Module &module, uint32_t slot);
+};
+
+#endif // HADRON_MODULE_H
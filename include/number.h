@@ -0,0 +1,20 @@
+#ifndef HADRON_NUMBER_H
+#define HADRON_NUMBER_H 1
+
+#include "types.h"
+
+#include <cstddef>
+
+typedef struct NumberLiteral {
+  Type   type;   // DEC, HEX, OCTAL, BINARY or ERROR
+  bool   dotted; // a '.' right after the literal cannot be part of it
+  size_t length; // characters consumed
+  double value;
+} NumberLiteral;
+
+// Scans the literal at the start of `s[0..n)` in a single pass. Digits are
+// accumulated into an integer mantissa and exponent, which are converted to
+// the nearest double with a single rounding.
+NumberLiteral scan_number(const char *s, size_t n);
+
+#endif // HADRON_NUMBER_H
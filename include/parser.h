@@ -1,9 +1,15 @@
 #ifndef HADRON_PARSER_H
 #define HADRON_PARSER_H 1
 
+#include "ir.h"
 #include "lexer.h"
 #include "logger.h"
+#include "module.h"
 #include "symbol.h"
+#include "tokens.h"
+
+#include <string>
+#include <unordered_map>
 
 enum class Precedence : int8_t {
   NUL = -1,
@@ -26,20 +32,104 @@ enum class Precedence : int8_t {
   MAX,
 };
 
+// The function being parsed, or the top-level script
+typedef struct Scope {
+  SymbolTable             locals;
+  uint32_t                count{0};        // locals declared so far
+  int                     depth{0};        // values the code leaves on stack
+  std::vector<SymbolType> types;           // what is known of each of them
+  bool                    script{true};    // not in a function
+  bool                    branched{false}; // split into blocks by jumps
+  IrFunction              ir; // unless the parse rules write bytecode directly
+} Scope;
+
+// A call to a function defined further down, patched once it is
+typedef struct CallFixup {
+  int         at; // of the call
+  std::string name;
+} CallFixup;
+
+// A function as the calls to it see it at -O2
+typedef struct Inlinee {
+  const char *blocker{nullptr}; // why calls keep calling it, null if inlined
+  IrFunction  body;             // optimized, kept while it can be inlined
+} Inlinee;
+
 typedef class Parser {
   public:
-  Lexer      &lexer;
-  Chunk      &chunk;
-  Token       current_token{};
-  Token       prev_token{};
-  SymbolTable symbols;
+  Lexer           &lexer;
+  Chunk           &chunk;
+  TokenStream      tokens;
+  // Both point into the token ring and move on with every advance
+  const Token     *current_token{nullptr};
+  const Token     *prev_token{nullptr};
+  // Line breaks in front of the tokens so far, equal counts mean equal lines
+  uint32_t         line_breaks{0};
+  SymbolTable      symbols;
+  // Built on the first mark unless one is handed in
+  const LineIndex *lines{nullptr};
+  LineIndex        own_lines;
+  // -O level, at 0 the parse rules write bytecode directly. Otherwise they
+  // build the IR of each function, which is optimized before it is lowered.
+  int              optimization{0};
+  Scope            scope;
+
+  // Top-level functions, and the functions of other modules called
+  std::vector<ModuleExport> exports;
+  std::vector<ModuleImport> imports;
+  std::vector<CallFixup>    fixups;
+  // Functions defined so far by name, and whether to log what became of
+  // each call to them
+  std::unordered_map<std::string, Inlinee> inlinees;
+  bool                                     report_inlining{false};
 
   explicit Parser(Lexer &lexer, Chunk &chunk);
-  void     advance();
-  Token   &consume(Type type, const char *error);
-  bool     match(Type type);
+  // Lexes on demand from wherever the lexer is, for parts of a source whose
+  // positions are looked up in `lines`
+  Parser(Lexer &lexer, Chunk &chunk, const LineIndex *lines);
+  // Parses already lexed tokens, `tokens` ends with an END token. Positions
+  // are looked up in `lines`, the line index of the lexer's source.
+  Parser(Lexer &lexer, Chunk &chunk, const Token *tokens, size_t length,
+    const LineIndex *lines = nullptr);
+  void         advance();
+  const Token &consume(Type type, const char *error);
+  bool         match(Type type);
+  void         mark(const Token &token);
+  void         mark(uint32_t offset);
+  void         locate(uint32_t offset, int *line, int *column);
+
+  // Operations of the parse rules, marked with the position of `token`
+  void emit(OpCode op, const Token &token);
+  void emit(double number, const Token &token);
+  // Locals of the current function. At -O0 a local lives in the slot of its
+  // index, otherwise it names the value last assigned to it.
+  uint32_t declare(const Token &name, SymbolType type);
+  // A local no name refers to, for values the code of a statement keeps
+  uint32_t reserve();
+  void     emit_load(uint32_t local, SymbolType type, const Token &token);
+  void     emit_store(uint32_t local, const Token &token);
+  // Calls the function `name` with the `argc` values on top of the stack
+  void     emit_call(const Token &name, uint8_t argc, const Token &token);
+  // The same for the function behind an import slot
+  void     emit_call(uint32_t import, uint8_t argc, const Token &token);
+  // Import slot of the function `name` of `module`
+  uint32_t import(const Token &module, const Token &name);
+  // Jumps are relative to the jump, patched once the target is known. With
+  // the IR the block before a jump or a label is lowered first.
+  int      emit_jump(OpCode op, const Token &token);
+  void     patch_jump(int jump, int target);
+  // Jumps back to `target`, where a loop starts. Its offset is known, so the
+  // jump takes a single byte for it when it fits.
+  void     emit_loop(OpCode op, int target, const Token &token);
+  int      label(const Token &token);
+  void     settle(const Token &token);
+  // Optimizes the IR of a function and writes its bytecode
+  void     lower(IrFunction &function);
+  // Lowers the IR of the script parsed so far
+  void     flush();
 
   void parse();
+  void parse_statement();
   void parse_expression(Precedence precedence);
 } Parser;
 
@@ -0,0 +1,29 @@
+#ifndef HADRON_SCAN_H
+#define HADRON_SCAN_H 1
+
+#include <cstddef>
+
+// Bulk classification kernels used by the lexer on contiguous sources. Every
+// kernel returns the length of the matching prefix of `s[0..n)`, or `n`.
+typedef struct Scanner {
+  const char *name;
+  // Whitespace and line continuations: ' ', '\t', '\r', '\n' and '\\'
+  size_t (*space)(const char *s, size_t n);
+  // Identifier characters: letters, digits, '_' and '$'
+  size_t (*ident)(const char *s, size_t n);
+  // Everything up to the first `a`, `b` or `c`
+  size_t (*find)(const char *s, size_t n, char a, char b, char c);
+  // Number of `c` in `s[0..n)`
+  size_t (*count)(const char *s, size_t n, char c);
+  // Well-formed UTF-8
+  size_t (*utf8)(const char *s, size_t n);
+} Scanner;
+
+// The fastest implementation supported by the running CPU
+extern Scanner scanner;
+
+// Selects an implementation by name ("scalar", "sse2" or "avx2"), returns
+// false when it is not available on this CPU
+bool use_scanner(const char *name);
+
+#endif // HADRON_SCAN_H
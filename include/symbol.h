@@ -3,35 +3,86 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
 
-#define SYMBOL_NAME_LEN   0x20
-#define SYMBOL_TABLE_SIZE 0x100
+#define SYMBOL_GROUP_SIZE 0x10 // control bytes probed at once
+#define SYMBOL_INLINE     0x40 // slots and symbols kept in the table itself
+#define SYMBOL_BLOCK_SIZE 0x40 // symbols allocated at once past those
 
 typedef enum class SymbolType : uint8_t {
   NUL,
   FUNCTION,
-  I32,
+  I32, // a local known to hold an integer
+  F64, // a local holding any number
   STR,
+  MODULE, // imported as a whole
+  IMPORT, // a function imported from a module, located at its import slot
 } SymbolType;
 
 struct Symbol {
   SymbolType type{0};
-  bool       in_use{false};
-  int        location{0};
-  char       name[SYMBOL_NAME_LEN]{};
+  uint8_t    arity{0};    // parameters of a function
+  int        location{0}; // address of a function, slot of a local
+  uint32_t   name{0};     // offset of the name in the names of its table
+  uint32_t   length{0};
 };
 
+// Where a symbol is found, with its hash kept to skip comparing names that
+// cannot match and to grow the table without hashing them again
+typedef struct SymbolSlot {
+  uint32_t hash;
+  uint32_t symbol;
+} SymbolSlot;
+
+// Open addressing over groups of SYMBOL_GROUP_SIZE slots, each with a
+// control byte telling whether it is empty, removed, or holding a symbol
+// whose hash has the seven low bits of the byte. A lookup compares the bytes
+// of a group at once and only looks at the names of the slots that match.
+// The first SYMBOL_INLINE slots and symbols live in the table itself, which
+// is more than most scopes declare, so those tables only allocate for their
+// names. Symbols stay where they are until they are removed, pointers to
+// them remain valid as long as the table is not moved.
 class SymbolTable {
-  Symbol table[SYMBOL_TABLE_SIZE]{};
+  uint8_t                                first_control[SYMBOL_INLINE];
+  SymbolSlot                             first_slots[SYMBOL_INLINE];
+  Symbol                                 first[SYMBOL_INLINE];
+  std::unique_ptr<uint8_t[]>             grown_control; // once there are
+  std::unique_ptr<SymbolSlot[]>          grown_slots;   // more slots
+  std::vector<std::unique_ptr<Symbol[]>> blocks;
+  std::vector<uint32_t>                  unused;  // symbols removed
+  std::string                            names;   // of the symbols in use
+  size_t                                 dropped{0}; // bytes of removed names
+  uint32_t                               capacity{SYMBOL_INLINE};
+  uint32_t                               count{0};
+  uint32_t                               created{0}; // symbols ever used
+  uint32_t                               used{0};    // slots not empty
 
-  static size_t hash(const char *name);
+  static uint32_t hash(const char *name, size_t length);
 
-  Symbol *get_entry(const char *name);
+  [[nodiscard]] uint8_t    *control() const;
+  [[nodiscard]] SymbolSlot *slots() const;
+  Symbol &symbol(uint32_t index) const;
+  size_t  find(const char *name, size_t length, uint32_t hash) const;
+  void    place(uint32_t hash, uint32_t index);
+  void    grow();
+  void    compact();
 
   public:
-  bool insert(const char *name, int location, SymbolType type);
+  SymbolTable();
+  SymbolTable(SymbolTable &&)            = default;
+  SymbolTable &operator=(SymbolTable &&) = default;
+
+  // Names do not need to be terminated, they are copied into the table.
+  // Fails if the name is in the table already.
+  bool insert(const char *name, size_t length, int location, SymbolType type);
+  // Pointers to the symbol are not valid anymore once it is removed
+  bool remove(const char *name, size_t length);
 
-  Symbol *lookup(const char *name);
+  Symbol     *lookup(const char *name, size_t length) const;
+  const char *name_of(const Symbol &symbol) const;
+  size_t      size() const { return count; }
 };
 
 #endif // HADRON_SYMBOL_H
@@ -0,0 +1,20 @@
+#ifndef HADRON_TOKENIZE_H
+#define HADRON_TOKENIZE_H 1
+
+#include "types.h"
+
+#include <cstddef>
+#include <vector>
+
+#define LEX_CHUNKS_PER_THREAD 4
+#define MIN_LEX_CHUNK         0x10000 // smaller pieces are not worth a split
+#define LEX_PARALLEL_SOURCE   0x100000 // modules this large are tokenized
+
+// Tokenizes a contiguous source on up to `threads` workers. The source is
+// split at newlines and every piece is lexed speculatively, pieces that turn
+// out to start inside a string or comment are lexed again in order. The
+// result is the token stream of the serial lexer, END included.
+std::vector<Token> tokenize(
+  const char *source, size_t length, unsigned threads);
+
+#endif // HADRON_TOKENIZE_H
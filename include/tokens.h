@@ -0,0 +1,52 @@
+#ifndef HADRON_TOKENS_H
+#define HADRON_TOKENS_H 1
+
+#include "lexer.h"
+
+#include <atomic>
+#include <thread>
+
+#define TOKEN_RING_SIZE   0x400 // power of 2
+#define TOKEN_BATCH       0x40
+#define TOKEN_HELD        2        // previous and current token of the parser
+#define LEX_THREAD_SOURCE 0x100000 // sources this large are lexed on a thread
+
+// Ring buffer of tokens between the lexer and the parser. The lexer fills it
+// a batch at a time, either on demand or from its own thread, and the parser
+// reads tokens in place. Only the last TOKEN_HELD tokens handed out stay
+// valid, anything kept longer has to be copied. Already lexed tokens can be
+// replayed instead, then the lexer is not used at all.
+class TokenStream {
+  Lexer       &lexer;
+  Token        ring[TOKEN_RING_SIZE]{};
+  Token        end_token{};
+  bool         threaded{false};
+  const Token *replay{nullptr}; // ends with an END token
+  size_t       replay_length{0};
+
+  uint32_t              head{0};   // next token handed out, parser side
+  std::atomic<uint32_t> tail{0};   // next slot filled, lexer side
+  std::atomic<uint32_t> released{0};
+  std::atomic<bool>     done{false};
+  std::atomic<bool>     stop{false};
+  std::thread           worker;
+
+  uint32_t fill(uint32_t slot, bool *ended);
+  void     produce();
+
+  public:
+  TokenStream(Lexer &lexer, bool threaded);
+  TokenStream(Lexer &lexer, const Token *tokens, size_t length);
+  ~TokenStream();
+  TokenStream(const TokenStream &)            = delete;
+  TokenStream &operator=(const TokenStream &) = delete;
+
+  const Token &next();
+  // Starts over with what the lexer reads next, once it has been reset.
+  // Streams lexed on a thread or replayed are only read once.
+  void reset();
+  // Tokens handed out so far
+  [[nodiscard]] size_t consumed() const { return head; }
+};
+
+#endif // HADRON_TOKENS_H
@@ -0,0 +1,19 @@
+#ifndef HADRON_TRANSPILE_H
+#define HADRON_TRANSPILE_H 1
+
+#include "module.h"
+
+#include <string>
+
+// C doing what the VM does with the code of `module` and of the modules it
+// imports, which are linked now instead of on the first call. Values are
+// doubles as in the VM, whose stack, slots and frames become arrays of the
+// program. Each instruction becomes the statements running it, jumps and
+// calls become gotos and runtime errors report what the VM would.
+std::string transpile(Module &module, ModuleCache &modules);
+
+// Compiles the C file `source` into the executable `path` with the system C
+// compiler, the one $CC names or cc
+void compile_c(const char *source, const char *path);
+
+#endif // HADRON_TRANSPILE_H
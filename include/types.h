@@ -49,6 +49,7 @@ typedef enum class Types : uint8_t {
   FX,
   IF,
   IMPORT,
+  IN,
   NEW,
   RETURN,
   SELECT,
@@ -107,6 +108,12 @@ typedef enum class Types : uint8_t {
   MAX_TOKENS
 } Type;
 
+// A view into the source, only copied when it has to outlive the source
+typedef struct Slice {
+  uint32_t offset;
+  uint32_t length;
+} Slice;
+
 typedef union Any {
   char               i8;
   short              i16;
@@ -119,21 +126,29 @@ typedef union Any {
   float              f32;
   double             f64;
   void              *ptr;
+  Slice              slice;
 } Any;
 
+// A line break lies between the start of the previous token and this one
+#define TOKEN_NEWLINE 0x01
+
+// Tokens only keep where they are in the source. Lines and columns come from
+// the line index of the source, number values from the literal itself.
 typedef struct Token {
-  Type type;
-  // todo temp
-  uint8_t index{};
-
-  struct Position {
-    int line;
-    int start;
-    int end;
-    int absStart;
-    int absEnd;
-  } pos;
-  Any value;
+  Type     type;
+  uint8_t  flags;   // TOKEN_* bits
+  uint32_t offset;  // of the first byte in the source
+  uint32_t length;  // in bytes
+  uint32_t payload; // string constant index of STR tokens
 } Token;
 
+static_assert(sizeof(Token) == 16, "Tokens are meant to stay compact");
+
+// The bytes a NAME or STR token stands for, without the quotes
+inline Slice token_text(const Token &token) {
+  if (token.type == Types::STR)
+    return {token.offset + 1, token.length - 2};
+  return {token.offset, token.length};
+}
+
 #endif // HADRON_TYPES_H
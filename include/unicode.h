@@ -0,0 +1,16 @@
+#ifndef HADRON_UNICODE_H
+#define HADRON_UNICODE_H 1
+
+#include <cstddef>
+#include <cstdint>
+
+// Decodes the UTF-8 sequence at the start of `s[0..n)`. Returns its length,
+// or 0 when it is not well-formed: truncated, overlong, a surrogate or past
+// U+10FFFF.
+size_t utf8_decode(const char *s, size_t n, uint32_t *code_point);
+
+// Unicode identifier characters (XID_Start, XID_Continue) outside of ASCII
+bool is_ident_start(uint32_t code_point);
+bool is_ident_continue(uint32_t code_point);
+
+#endif // HADRON_UNICODE_H
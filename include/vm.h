@@ -1,57 +1,122 @@
 #ifndef HADRON_VM_H
 #define HADRON_VM_H
 
+#include "lines.h"
 #include "util.h"
 
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <type_traits>
 
 typedef enum class OpCodes : uint8_t {
-  RETURN     = 'r',
-  MOVE       = 'm',
-  ADD        = '+',
-  SUB        = '-',
-  MUL        = '*',
-  DIV        = '/',
-  POW        = 'p',
-  L_AND      = 'a',
-  L_OR       = 'o',
-  B_AND      = '&',
-  B_OR       = '|',
-  B_XOR      = '^',
-  B_NOT      = '~',
-  NOT        = '!',
-  NEGATE     = 'n',
-  LOAD       = 'l',
-  STORE      = 's',
-  RANGE_EXCL = 0x80,
-  RANGE_L_IN = 0x81,
-  RANGE_R_IN = 0x82,
-  RANGE_INCL = 0x83,
-  FX_ENTRY   = 0x90,
-  FX_EXIT    = 0x91,
+  RETURN           = 'r',
+  MOVE             = 'm',
+  ADD              = '+',
+  SUB              = '-',
+  MUL              = '*',
+  DIV              = '/',
+  POW              = 'p',
+  L_AND            = 'a',
+  L_OR             = 'o',
+  B_AND            = '&',
+  B_OR             = '|',
+  B_XOR            = '^',
+  B_NOT            = '~',
+  NOT              = '!',
+  NEGATE           = 'n',
+  LOAD             = 'l',
+  STORE            = 's',
+  CALL             = 'c',
+  CALL_EXT         = 'e', // into another module
+  TAILCALL         = 't', // reusing the frame of the caller
+  POP              = 'x',
+  JUMP             = 'j',
+  JUMP_FALSE       = 'f', // taking the condition off the stack
+  // The same with a one byte offset, for the backward jumps of short loops
+  JUMP_SHORT       = 'J',
+  JUMP_FALSE_SHORT = 'F',
+  RANGE_EXCL       = 0x80,
+  RANGE_L_IN       = 0x81,
+  RANGE_R_IN       = 0x82,
+  RANGE_INCL       = 0x83,
+  FX_ENTRY         = 0x90,
+  FX_EXIT          = 0x91,
+  CMP_EQ           = 0xB0,
+  CMP_NEQ          = 0xB1,
+  CMP_LT           = 0xB2,
+  CMP_LEQ          = 0xB3,
+  CMP_GT           = 0xB4,
+  CMP_GEQ          = 0xB5,
+  // Bitwise operations on values known to be integers
+  I32_AND          = 0xA0,
+  I32_OR           = 0xA1,
+  I32_XOR          = 0xA2,
+  I32_NOT          = 0xA3,
 } OpCode;
 
+// Low 32 bits of an integer, which is what bitwise operations work on.
+// Integers are kept in doubles like every other number.
+inline int32_t i32_bits(const double value) {
+  if (!std::isfinite(value))
+    return 0;
+  return static_cast<int32_t>(static_cast<uint32_t>(
+    static_cast<int64_t>(std::fmod(value, 4294967296.0))));
+}
+
+// Bytes an instruction takes, operands included
+inline int instruction_size(const OpCode op) {
+  switch (op) {
+    case OpCodes::MOVE:
+      return 10;
+    case OpCodes::LOAD:
+    case OpCodes::STORE:
+    case OpCodes::JUMP_SHORT:
+    case OpCodes::JUMP_FALSE_SHORT:
+      return 2;
+    case OpCodes::CALL:
+    case OpCodes::CALL_EXT:
+    case OpCodes::TAILCALL:
+      return 5;
+    case OpCodes::FX_ENTRY:
+    case OpCodes::JUMP:
+    case OpCodes::JUMP_FALSE:
+      return 3;
+    default:
+      return 1;
+  }
+}
+
 #define MAX_INSTRUCTIONS 1024
 
 class Chunk {
   public:
-  int     pos{0};
-  uint8_t code[MAX_INSTRUCTIONS]{};
+  int       pos{0};
+  uint8_t   code[MAX_INSTRUCTIONS]{};
+  LineTable lines{}; // debug only, never read while executing
+
+  // Fails the compile, code has no room for what is written
+  static void overflow();
 
   template <typename T> void write(T value) {
     if constexpr (std::is_same_v<T, char *>) {
       const size_t len = h_strlen(value);
+      if (len > MAX_INSTRUCTIONS - static_cast<size_t>(pos))
+        overflow();
       for (size_t i = 0; i < len; i++) {
         code[pos++] = value[i];
       }
     } else {
+      if (sizeof(T) > MAX_INSTRUCTIONS - static_cast<size_t>(pos))
+        overflow();
       *reinterpret_cast<T *>(code + pos) = value;
       pos += sizeof(T);
     }
   }
-  void clear() { pos = 0; }
+  void clear() {
+    pos = 0;
+    lines.clear();
+  }
 };
 
 typedef enum InterpretResult {
@@ -60,21 +125,54 @@ typedef enum InterpretResult {
   INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
-#define MAX_STACK     0x100
-#define MAX_CONSTANTS 0x100
+#define MAX_STACK       0x1000
+#define MAX_CONSTANTS   0x100
+#define MAX_FRAME_SLOTS 0x100 // slot operands are one byte
+#define MAX_SLOTS       0x10000
+#define MAX_FRAMES      0x1000
+
+class Module;
+class ModuleCache;
+
+// Where a call returns to. Slots are addressed from the base of the frame,
+// the frame of a call starts after the slots its caller keeps.
+typedef struct Frame {
+  int     ip;     // of the instruction after the call
+  int     base;   // of the caller's slots
+  int     sp;     // below the arguments of the call
+  Module *module; // of the caller, null for a chunk run on its own
+} Frame;
+
+// Called on every backward jump, which every loop takes once per iteration,
+// with the position of the jump. Returning false stops the program with a
+// runtime error there.
+typedef bool (*LoopHook)(void *context, const Chunk &chunk, int ip);
 
 typedef class VM {
   // Chunk *chunk;
   // uint8_t *ip;
   double stack[MAX_STACK]{};
+  double slots[MAX_SLOTS]{}; // locals and values kept off the stack
+  Frame  frames[MAX_FRAMES]{};
   // double constants[MAX_CONSTANTS]{};
   int sp{-1};
+  int fp{0};   // frames in use
+  int base{0}; // of the current frame's slots
   // int pc{-1};
+  LoopHook loop_hook{nullptr};
+  void    *loop_context{nullptr};
+
+  InterpretResult run(Chunk &chunk, Module *module, ModuleCache *modules);
+  void            jump_back(const Chunk &chunk, int ip);
 
   public:
   VM() = default;
 
   InterpretResult interpret(Chunk &chunk);
+  // Calls into other modules load them from `modules` on the way
+  InterpretResult interpret(Module &module, ModuleCache &modules);
+  // `hook` sees every iteration of every loop, null turns it off
+  void            on_loop(LoopHook hook, void *context);
 } VM;
 
 #endif // HADRON_VM_H
@@ -0,0 +1,81 @@
+#include "build.h"
+#include "module.h"
+#include "halloc.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <dirent.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+typedef struct Source {
+  std::string path;
+  size_t      size;
+} Source;
+
+// Hidden entries are skipped, symbolic links are not followed
+static void find_sources(const std::string &dir, std::vector<Source> &sources) {
+  DIR *stream = opendir(dir.c_str());
+  if (!stream) {
+    Logger::fatal("Directory could not be opened");
+  }
+  while (const dirent *entry = readdir(stream)) {
+    if (entry->d_name[0] == '.')
+      continue;
+    const std::string path = dir + "/" + entry->d_name;
+    struct stat       info {};
+    if (lstat(path.c_str(), &info) == -1)
+      continue;
+    if (S_ISDIR(info.st_mode)) {
+      find_sources(path, sources);
+      continue;
+    }
+    const size_t length = strlen(entry->d_name);
+    if (S_ISREG(info.st_mode) && length > 4 &&
+        strcmp(entry->d_name + length - 4, ".hdn") == 0)
+      sources.push_back({path, static_cast<size_t>(info.st_size)});
+  }
+  closedir(stream);
+}
+
+size_t build(const char *dir, const int optimization, unsigned threads) {
+  std::vector<Source> sources;
+  find_sources(dir, sources);
+  // Largest first, so that no worker picks up a big file when the others
+  // are about to finish
+  std::sort(sources.begin(), sources.end(),
+    [](const Source &a, const Source &b) { return a.size > b.size; });
+
+  if (!threads)
+    threads = 1;
+  const unsigned cores = threads;
+  if (threads > sources.size())
+    threads = static_cast<unsigned>(sources.size());
+  // Cores left over once every worker has one lex the large sources
+  const unsigned lex_threads = threads ? cores / threads : 1;
+
+  // Workers take the next source until none are left, the arena only holds
+  // what the file being compiled needs
+  std::atomic<size_t> next{0};
+  const auto          work = [&] {
+    for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) <
+                   sources.size();) {
+      File   file(sources[i].path.c_str(), FILE_MODE_READ);
+      Module module;
+      compile_module(file, module, optimization, lex_threads);
+      write_module(file, module);
+      hreset();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < threads; i++)
+    workers.emplace_back(work);
+  work();
+  for (auto &worker : workers)
+    worker.join();
+  return sources.size();
+}
@@ -0,0 +1,161 @@
+#include "bundle.h"
+#include "logger.h"
+
+#include <cstring>
+
+constexpr char bundle_magic[FILE_HEADER_MAGIC_SIZE] = {'\x7F', 'H', 'B', 'B'};
+
+#define BUNDLE_MAJOR 0
+#define BUNDLE_MINOR 2
+
+uint32_t bundle_hash(const char *name, const size_t length) {
+  uint32_t hash = 5381;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash << 5) + hash + static_cast<uint8_t>(name[i]); // hash * 33 + c
+  }
+  return hash;
+}
+
+Bundle::Bundle(File &file) {
+  if (file.map(&data, &size) != FILE_STATUS_OK) {
+    Logger::fatal("Bundle could not be mapped");
+  }
+  if (size < sizeof(BundleHeader) ||
+      strncmp(bundle_magic, reinterpret_cast<const char *>(data),
+        FILE_HEADER_MAGIC_SIZE) != 0) {
+    Logger::fatal("Bundle header magic not correct");
+  }
+  header = reinterpret_cast<const BundleHeader *>(data);
+  if (header->major != BUNDLE_MAJOR || header->minor != BUNDLE_MINOR) {
+    Logger::fatal("Unsupported bundle version");
+  }
+  const size_t slots = header->slots;
+  if (!slots || slots & (slots - 1) || header->entry >= slots ||
+      sizeof(BundleHeader) + slots * sizeof(BundleEntry) > size) {
+    Logger::fatal("Bundle index is corrupted");
+  }
+  index = reinterpret_cast<const BundleEntry *>(data + sizeof(BundleHeader));
+}
+
+bool Bundle::has_name(const BundleEntry *entry) const {
+  return entry->name + static_cast<size_t>(entry->name_length) <= size;
+}
+
+const BundleEntry *Bundle::find(const char *name, const size_t length) const {
+  const uint32_t hash = bundle_hash(name, length);
+  const uint32_t mask = header->slots - 1;
+  for (uint32_t i = 0; i < header->slots; i++) {
+    const BundleEntry *entry = &index[(hash + i) & mask];
+    if (!entry->name_length) {
+      return nullptr; // probing stops at the first empty slot
+    }
+    if (entry->hash == hash && entry->name_length == length &&
+        has_name(entry) && memcmp(data + entry->name, name, length) == 0) {
+      return entry;
+    }
+  }
+  return nullptr;
+}
+
+const BundleEntry *Bundle::entry() const {
+  const BundleEntry *entry = &index[header->entry];
+  return entry->name_length && has_name(entry) ? entry : nullptr;
+}
+
+bool Bundle::get_name(
+  const BundleEntry *entry, char *name, const size_t capacity) const {
+  if (!has_name(entry) || entry->name_length >= capacity) {
+    return false;
+  }
+  h_memcpy(name, data + entry->name, entry->name_length);
+  name[entry->name_length] = '\0';
+  return true;
+}
+
+bool Bundle::load(const BundleEntry *entry, Chunk &chunk) const {
+  if (entry->code + static_cast<size_t>(entry->code_length) > size ||
+      entry->code_length > MAX_INSTRUCTIONS ||
+      entry->lines + static_cast<size_t>(entry->lines_length) > size) {
+    return false;
+  }
+  chunk.clear();
+  h_memcpy(chunk.code, data + entry->code, entry->code_length);
+  chunk.pos = static_cast<int>(entry->code_length);
+  return chunk.lines.load(data + entry->lines, entry->lines_length);
+}
+
+void BundleWriter::add(const char *name, const Chunk &chunk) {
+  const size_t length = h_strlen(name);
+  for (const auto &module : modules) {
+    if (module.name.size() == length &&
+        memcmp(module.name.data(), name, length) == 0) {
+      Logger::fatal("Duplicate module name in bundle");
+    }
+  }
+  const LineTable &lines = chunk.lines;
+  modules.push_back({std::vector<char>(name, name + length),
+    std::vector<uint8_t>(chunk.code, chunk.code + chunk.pos),
+    std::vector<uint8_t>(lines.data, lines.data + lines.size)});
+}
+
+FileResult BundleWriter::write(const char *file_name) {
+  uint32_t slots = 1;
+  while (slots < modules.size() * 2) {
+    slots <<= 1;
+  }
+
+  BundleHeader header{};
+  h_memcpy(header.magic, bundle_magic, FILE_HEADER_MAGIC_SIZE);
+  header.major = BUNDLE_MAJOR;
+  header.minor = BUNDLE_MINOR;
+  header.count = static_cast<uint32_t>(modules.size());
+  header.slots = slots;
+
+  std::vector<BundleEntry> index(slots);
+  std::vector<uint32_t>    module_slots(modules.size());
+  std::vector<iovec>       vectors;
+  vectors.reserve(2 + modules.size() * 3);
+  vectors.push_back({&header, sizeof(BundleHeader)});
+  vectors.push_back({index.data(), slots * sizeof(BundleEntry)});
+
+  // Names directly follow the index so that lookups touch as few pages as
+  // possible, line tables come last as they are only read on errors
+  size_t offset = sizeof(BundleHeader) + slots * sizeof(BundleEntry);
+  for (size_t i = 0; i < modules.size(); i++) {
+    Module        &module = modules[i];
+    const uint32_t hash   = bundle_hash(module.name.data(), module.name.size());
+    uint32_t       slot   = hash & (slots - 1);
+    while (index[slot].name_length) {
+      slot = (slot + 1) & (slots - 1);
+    }
+    module_slots[i]         = slot;
+    index[slot].hash        = hash;
+    index[slot].name        = static_cast<uint32_t>(offset);
+    index[slot].name_length = static_cast<uint32_t>(module.name.size());
+    vectors.push_back({module.name.data(), module.name.size()});
+    offset += module.name.size();
+  }
+  for (size_t i = 0; i < modules.size(); i++) {
+    Module      &module = modules[i];
+    BundleEntry &entry  = index[module_slots[i]];
+    entry.code          = static_cast<uint32_t>(offset);
+    entry.code_length   = static_cast<uint32_t>(module.code.size());
+    vectors.push_back({module.code.data(), module.code.size()});
+    offset += module.code.size();
+  }
+  for (size_t i = 0; i < modules.size(); i++) {
+    Module      &module = modules[i];
+    BundleEntry &entry  = index[module_slots[i]];
+    entry.lines         = static_cast<uint32_t>(offset);
+    entry.lines_length  = static_cast<uint32_t>(module.lines.size());
+    vectors.push_back({module.lines.data(), module.lines.size()});
+    offset += module.lines.size();
+  }
+  if (offset > UINT32_MAX) {
+    return FILE_WRITE_FAILURE;
+  }
+  header.entry = modules.empty() ? 0 : module_slots[0];
+
+  File out(file_name, FILE_MODE_WRITE);
+  return out.write_vectored(vectors.data(), static_cast<int>(vectors.size()));
+}
@@ -0,0 +1,364 @@
+#include "document.h"
+#include "number.h"
+#include "parser.h"
+#include "scan.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+// The lexer decides on a token by looking up to two bytes past its end
+#define LEXER_LOOKAHEAD 2
+
+static bool is_number(const Type type) {
+  return type == Types::DEC || type == Types::HEX || type == Types::OCTAL ||
+         type == Types::BINARY;
+}
+
+// Whether `now` is `before`, which an edit moved. Equal tokens leave the
+// lexer in equal states, so everything after them is equal as well. The
+// bytes of the old token were not edited, so neither was its value.
+static bool moved_token(const Token &before, const Token &now) {
+  return before.type == now.type && before.flags == now.flags &&
+         before.offset == now.offset && before.length == now.length;
+}
+
+Document::Document(const char *source, const size_t length)
+  : text(std::vector<char>(source, source + length)) {
+  lines.build(source, length);
+  Input              input(text.tail(), length);
+  Lexer              lexer(input);
+  std::vector<Token> all;
+  do {
+    all.push_back(lexer.advance());
+  } while (all.back().type != Types::END);
+  tokens  = GapList<Token, TokenPlace>(std::move(all));
+  relexed = tokens.size();
+  reparse(0, 0, 0, tokens.size());
+}
+
+Token Document::token(const size_t index) const {
+  return tokens.at(index, text.size());
+}
+
+size_t Document::unit_first(const size_t index) const {
+  return units.position(index, tokens.size());
+}
+
+// Lexes on from the end of the token before `next`. The text gap lies ahead
+// of that token.
+void Document::resume(Lexer &lexer, const size_t next) const {
+  if (!next) {
+    lexer.seek(0);
+    return;
+  }
+  const Token last  = token(next - 1);
+  const char *bytes = text.tail() + last.offset;
+  const bool  after_float =
+    is_number(last.type) && scan_number(bytes, last.length).dotted;
+  const bool  after_break =
+    scanner.find(bytes, last.length, '\n', '\n', '\n') < last.length;
+  lexer.seek(last.offset + last.length, after_float, after_break);
+}
+
+void Document::edit(const size_t offset, const size_t removed,
+  const char *inserted, const size_t length) {
+  const size_t size = text.size();
+  if (offset > size || removed > size - offset)
+    Logger::fatal("Edit out of range");
+
+  // Tokens far enough ahead of the edit are kept, lexing resumes after them
+  const size_t keep =
+    partition_index(0, tokens.size(), tokens.split(), [&](const size_t i) {
+      const Token kept = token(i);
+      return kept.offset + kept.length + LEXER_LOOKAHEAD <= offset;
+    });
+  // Parsing resumes at the statement before the one holding that token
+  size_t unit =
+    partition_index(0, units.size(), units.split(), [&](const size_t i) {
+      return unit_first(i) + units.stored(i).count <= keep;
+    });
+  if (unit)
+    unit--;
+  const size_t start = unit < units.size() ? unit_first(unit) : 0;
+
+  // Everything past those moves with the end of the text
+  tokens.move(keep, size);
+  units.move(unit, tokens.size());
+  text.move(offset, 0);
+  text.erase(removed);
+  text.insert(inserted, inserted + length);
+  text.move(start ? token(start - 1).offset : 0, 0);
+  lines.edit(offset, removed, inserted, length);
+
+  relex(offset, length, keep);
+
+  // The rest of the edited line moved to other columns, the statements it
+  // belongs to are compiled again as well
+  const size_t end     = offset + length;
+  const size_t newline = end + scanner.find(text.tail() + end,
+                                 text.size() - end, '\n', '\n', '\n');
+  const size_t rest    = keep + relexed;
+  const size_t moved =
+    partition_index(rest, tokens.size(), rest,
+      [&](const size_t i) { return token(i).offset <= newline; }) -
+    rest;
+  reparse(unit, start, keep, relexed + moved);
+}
+
+// Swaps the tokens from `keep` on for `relexed` new ones, until those line up
+// with the old ones again. Tokens from `keep` on already moved with the end of
+// the text.
+void Document::relex(
+  const size_t offset, const size_t length, const size_t keep) {
+  Input input(text.tail(), text.size());
+  Lexer lexer(input);
+  resume(lexer, keep);
+
+  // Old tokens past the edit are candidates to line up with
+  const size_t       edit_end = offset + length;
+  size_t             old      = keep;
+  std::vector<Token> fresh;
+  for (;;) {
+    const Token token = lexer.advance();
+    while (old < tokens.size() &&
+           (this->token(old).offset < edit_end ||
+             this->token(old).offset < token.offset))
+      old++;
+    if (old < tokens.size() && moved_token(this->token(old), token))
+      break;
+    fresh.push_back(token);
+    if (token.type == Types::END) {
+      old = tokens.size();
+      break;
+    }
+  }
+
+  tokens.erase(old - keep);
+  tokens.insert(fresh.begin(), fresh.end());
+  relexed = fresh.size();
+}
+
+// Adds the locals the statement of `count` tokens at `first` declared, which
+// took the slots from `taken` on. Their names are among its tokens.
+static void declared(const Parser &parser, const Token *tokens,
+  const char *text, const size_t count, const uint32_t taken,
+  std::vector<DocumentLocal> &locals) {
+  const size_t known = locals.size();
+  for (size_t i = 0; i < count; i++) {
+    if (tokens[i].type != Types::NAME)
+      continue;
+    const char   *name  = text + tokens[i].offset;
+    const Symbol *local = parser.scope.locals.lookup(name, tokens[i].length);
+    if (!local || static_cast<uint32_t>(local->location) < taken ||
+        std::any_of(locals.begin() + static_cast<long>(known), locals.end(),
+          [&](const DocumentLocal &seen) {
+            return seen.slot == static_cast<uint32_t>(local->location);
+          }))
+      continue;
+    locals.push_back({std::string(name, tokens[i].length),
+      static_cast<uint32_t>(local->location), local->type});
+  }
+  std::sort(locals.begin() + static_cast<long>(known), locals.end(),
+    [](const DocumentLocal &a, const DocumentLocal &b) {
+      return a.slot < b.slot;
+    });
+}
+static bool same_locals(
+  const DocumentLocal *a, const DocumentLocal *b, const size_t count) {
+  for (size_t i = 0; i < count; i++)
+    if (a[i].slot != b[i].slot || a[i].type != b[i].type ||
+        a[i].name != b[i].name)
+      return false;
+  return true;
+}
+
+// Adds the functions the statement of `count` tokens defined, whose names are
+// among its tokens. Later statements know them by name only, their calls
+// are left for linking.
+static void defined(Parser &parser, const Token *tokens, const char *text,
+  const size_t count, std::unordered_set<std::string> &names,
+  std::vector<DocumentFunction> &functions) {
+  for (size_t i = 1; i < count; i++) {
+    if (tokens[i - 1].type != Types::FX || tokens[i].type != Types::NAME)
+      continue;
+    const char *name     = text + tokens[i].offset;
+    Symbol     *function = parser.symbols.lookup(name, tokens[i].length);
+    if (!function || function->type != SymbolType::FUNCTION ||
+        function->location < 0)
+      continue;
+    if (!names.emplace(name, tokens[i].length).second)
+      Logger::fatal("Function already defined");
+    functions.push_back({std::string(name, tokens[i].length),
+      static_cast<uint32_t>(function->location), function->arity});
+    function->location = -1;
+  }
+}
+static bool same_functions(
+  const DocumentFunction *a, const DocumentFunction *b, const size_t count) {
+  for (size_t i = 0; i < count; i++)
+    if (a[i].arity != b[i].arity || a[i].name != b[i].name)
+      return false;
+  return true;
+}
+
+// Statements are parsed again from `unit`, which starts at token `start`,
+// until they line up with the old ones again, right after the `count` new
+// tokens at `first`, and leave the script with the locals and functions it
+// had there. The statement before the edit is parsed as well, it looks at the
+// token that follows it. Statements from `unit` on already moved with the
+// tokens.
+void Document::reparse(const size_t unit, const size_t start,
+  const size_t first, const size_t count) {
+  Input  input(text.tail(), text.size());
+  Lexer  lexer(input);
+  Chunk  chunk;
+  Parser parser(lexer, chunk, &lines);
+  resume(lexer, start);
+  parser.advance();
+
+  // The parser starts with the locals the statements before declared
+  const uint32_t taken = unit ? units.stored(unit - 1).locals : 0;
+  size_t         kept  = 0;
+  for (; kept < locals.size() && locals[kept].slot < taken; kept++) {
+    const DocumentLocal &local = locals[kept];
+    parser.scope.locals.insert(local.name.data(), local.name.size(),
+      static_cast<int>(local.slot), local.type);
+  }
+  parser.scope.count = taken;
+  // and the functions they defined, known by name and arity only
+  const uint32_t                  known =
+    unit ? units.stored(unit - 1).functions : 0;
+  std::unordered_set<std::string> names;
+  for (uint32_t i = 0; i < known; i++) {
+    const DocumentFunction &function = functions[i];
+    parser.symbols.insert(function.name.data(), function.name.size(), -1,
+      SymbolType::FUNCTION);
+    parser.symbols.lookup(function.name.data(), function.name.size())->arity =
+      function.arity;
+    names.insert(function.name);
+  }
+
+  std::vector<DocumentUnit>     fresh;
+  std::vector<DocumentLocal>    fresh_locals;
+  std::vector<DocumentFunction> fresh_functions;
+  size_t                        old = unit;
+  for (;;) {
+    const size_t at = start + parser.tokens.consumed() - 1;
+    if (parser.current_token->type == Types::END) {
+      old = units.size();
+      break;
+    }
+    if (at >= first + count) {
+      while (old < units.size() && unit_first(old) < at)
+        old++;
+      // The statements after declared nothing else, the locals and the
+      // functions they see are the same as before
+      const uint32_t before = old ? units.stored(old - 1).locals : 0;
+      const auto     end    = static_cast<size_t>(
+        std::partition_point(locals.begin(), locals.end(),
+          [&](const DocumentLocal &local) { return local.slot < before; }) -
+        locals.begin());
+      const uint32_t had = old ? units.stored(old - 1).functions : 0;
+      if (old < units.size() && unit_first(old) == at &&
+          parser.scope.count == before &&
+          end - kept == fresh_locals.size() &&
+          same_locals(locals.data() + kept, fresh_locals.data(), end - kept) &&
+          had - known == fresh_functions.size() &&
+          same_functions(functions.data() + known, fresh_functions.data(),
+            fresh_functions.size()))
+        break;
+    }
+
+    const uint32_t slots = parser.scope.count;
+    chunk.clear();
+    parser.parse_statement();
+    DocumentUnit parsed;
+    parsed.first  = at;
+    parsed.count  = start + parser.tokens.consumed() - 1 - at;
+    parsed.line   = lines.line(token(at).offset);
+    parsed.locals = parser.scope.count;
+    parsed.code.assign(chunk.code, chunk.code + chunk.pos);
+    parsed.lines.assign(chunk.lines.data, chunk.lines.data + chunk.lines.size);
+    for (const CallFixup &fixup : parser.fixups)
+      parsed.calls.push_back({static_cast<uint32_t>(fixup.at), fixup.name});
+    parser.fixups.clear();
+    std::vector<Token> statement;
+    for (size_t i = at; i < at + parsed.count; i++)
+      statement.push_back(token(i));
+    if (parsed.locals > slots)
+      declared(parser, statement.data(), text.tail(), parsed.count, slots,
+        fresh_locals);
+    defined(parser, statement.data(), text.tail(), parsed.count, names,
+      fresh_functions);
+    parsed.functions = known + static_cast<uint32_t>(fresh_functions.size());
+    fresh.push_back(std::move(parsed));
+  }
+  if (old == units.size()) {
+    locals.resize(kept);
+    locals.insert(locals.end(), fresh_locals.begin(), fresh_locals.end());
+  }
+  // Functions the statements parsed again define are where their code has
+  // them now
+  const uint32_t had = old ? units.stored(old - 1).functions : 0;
+  functions.erase(functions.begin() + known, functions.begin() + had);
+  functions.insert(functions.begin() + known, fresh_functions.begin(),
+    fresh_functions.end());
+
+  units.erase(old - unit);
+  units.insert(std::make_move_iterator(fresh.begin()),
+    std::make_move_iterator(fresh.end()));
+  reparsed = fresh.size();
+}
+
+void Document::link(Chunk &chunk) const {
+  // Functions are placed first, statements call those of any statement
+  std::unordered_map<std::string, uint32_t> by_name;
+  std::vector<int>                          location(functions.size());
+  size_t                                    size = 0;
+  for (size_t i = 0, function = 0; i < units.size(); i++) {
+    const DocumentUnit &unit = units.stored(i);
+    for (; function < unit.functions; function++) {
+      by_name[functions[function].name] = static_cast<uint32_t>(function);
+      location[function] =
+        static_cast<int>(size + functions[function].location);
+    }
+    size += unit.code.size();
+  }
+  if (size > MAX_INSTRUCTIONS)
+    Logger::fatal("Program too large");
+
+  chunk.clear();
+  for (size_t i = 0; i < units.size(); i++) {
+    const DocumentUnit &unit = units.stored(i);
+    h_memcpy(chunk.code + chunk.pos, unit.code.data(), unit.code.size());
+    for (const DocumentCall &call : unit.calls) {
+      const int  at    = chunk.pos + static_cast<int>(call.at);
+      const auto found = by_name.find(call.name);
+      if (found == by_name.end())
+        Logger::fatal("Unknown function");
+      // The argument count follows the offset
+      if (chunk.code[at + 3] != functions[found->second].arity)
+        Logger::fatal("Wrong number of arguments");
+      *reinterpret_cast<int16_t *>(chunk.code + at + 1) =
+        static_cast<int16_t>(location[found->second] - at);
+    }
+    // Units keep the lines they were compiled with, edits above move them
+    chunk.lines.append(unit.lines.data(), unit.lines.size(), chunk.pos,
+      lines.line(token(unit_first(i)).offset) - unit.line);
+    chunk.pos += static_cast<int>(unit.code.size());
+  }
+}
+
+std::string Document::source() const {
+  const std::vector<char> all = text.list(0);
+  return std::string(all.begin(), all.end());
+}
+
+std::vector<Token> Document::token_list() const {
+  return tokens.list(text.size());
+}
+
+std::vector<DocumentUnit> Document::unit_list() const {
+  return units.list(tokens.size());
+}
@@ -2,8 +2,11 @@
 #include "logger.h"
 #include "memory.h"
 
+#include <cerrno>
+#include <climits>
 #include <cstring>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -71,6 +74,9 @@ void File::close() {
       Logger::fatal("Flush error");
     }
   }
+  if (mapping)
+    munmap(mapping, file_size);
+  mapping = nullptr;
   if (fp)
     fclose(fp);
   fp = nullptr;
@@ -127,23 +133,85 @@ FileResult File::write_flush() {
   return FILE_STATUS_OK;
 }
 
-constexpr char magic[FILE_HEADER_MAGIC_SIZE] = {'\x7F', 'H', 'B', 'C'};
+FileResult File::write(const void *data, const size_t length) {
+  if (mode != FILE_MODE_WRITE) {
+    return FILE_MODE_INVALID;
+  }
+  if (buffer_size + length > CHUNK_SIZE) {
+    if (const FileResult res = write_flush(); res != FILE_STATUS_OK) {
+      return res;
+    }
+  }
+  if (length > CHUNK_SIZE) {
+    // Copying into the buffer would only add a pass over the data
+    if (fwrite(data, sizeof(char), length, fp) != length) {
+      return FILE_WRITE_FAILURE;
+    }
+    return FILE_STATUS_OK;
+  }
+  h_memcpy(buffer + buffer_size, data, length);
+  buffer_size += length;
+  return FILE_STATUS_OK;
+}
 
-FileResult File::write_header() const {
+FileResult File::write_vectored(iovec *vectors, int count) {
   if (mode != FILE_MODE_WRITE) {
     return FILE_MODE_INVALID;
   }
-  FileHeader header;
-  h_memcpy(header.magic, magic, FILE_HEADER_MAGIC_SIZE);
-  header.major = 0;
-  header.minor = 1;
-  header.flags = 0;
-  header.name  = name_length();
-  if (fwrite(&header, sizeof(FileHeader), 1, fp) != 1)
+  // Everything queued so far must reach the descriptor before the vectors
+  if (buffer_size) {
+    if (const FileResult res = write_flush(); res != FILE_STATUS_OK) {
+      return res;
+    }
+  }
+  if (fflush(fp) != 0) {
     return FILE_WRITE_FAILURE;
+  }
+
+  const int fd = fileno(fp);
+  while (count > 0) {
+    if (vectors->iov_len == 0) {
+      vectors++;
+      count--;
+      continue;
+    }
+    const ssize_t written =
+      writev(fd, vectors, count < IOV_MAX ? count : IOV_MAX);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return FILE_WRITE_FAILURE;
+    }
+    auto remaining = static_cast<size_t>(written);
+    while (count > 0 && remaining >= vectors->iov_len) {
+      remaining -= vectors->iov_len;
+      vectors++;
+      count--;
+    }
+    if (count > 0) {
+      vectors->iov_base = static_cast<char *>(vectors->iov_base) + remaining;
+      vectors->iov_len -= remaining;
+    }
+  }
   return FILE_STATUS_OK;
 }
 
+constexpr char magic[FILE_HEADER_MAGIC_SIZE] = {'\x7F', 'H', 'B', 'C'};
+
+void File::fill_header(FileHeader *header) const {
+  h_memcpy(header->magic, magic, FILE_HEADER_MAGIC_SIZE);
+  header->major = 0;
+  header->minor = 2;
+  header->flags = 0;
+  header->name  = name_length();
+}
+
+FileResult File::write_header() {
+  FileHeader header;
+  fill_header(&header);
+  return write(&header, sizeof(FileHeader));
+}
+
 FileResult File::read_header(FileHeader *header) {
   if (mode != FILE_MODE_READ) {
     return FILE_MODE_INVALID;
@@ -169,6 +237,39 @@ FileResult File::read_name(char *name, const size_t length) {
   return FILE_STATUS_OK;
 }
 
+FileResult File::read_section(FileSection *section) {
+  if (mode != FILE_MODE_READ) {
+    return FILE_MODE_INVALID;
+  }
+  if (fread(section, sizeof(FileSection), 1, fp) != 1) {
+    return feof(fp) ? FILE_READ_DONE : FILE_READ_FAILURE;
+  }
+  position += sizeof(FileSection);
+  return FILE_STATUS_OK;
+}
+
+FileResult File::read_data(void *data, const size_t length) {
+  if (mode != FILE_MODE_READ) {
+    return FILE_MODE_INVALID;
+  }
+  if (fread(data, sizeof(char), length, fp) != length) {
+    return FILE_READ_FAILURE;
+  }
+  position += length;
+  return FILE_STATUS_OK;
+}
+
+FileResult File::skip(const size_t length) {
+  if (mode != FILE_MODE_READ) {
+    return FILE_MODE_INVALID;
+  }
+  if (fseek(fp, static_cast<long>(length), SEEK_CUR) != 0) {
+    return FILE_READ_FAILURE;
+  }
+  position += length;
+  return FILE_STATUS_OK;
+}
+
 FileResult File::lookup_byte(char *pc) const {
   if (mode != FILE_MODE_READ) {
     return FILE_MODE_INVALID;
@@ -198,13 +299,35 @@ FileResult File::read_chunk(
   return FILE_STATUS_OK;
 }
 
+FileResult File::map(const uint8_t **data, size_t *size) {
+  if (mode != FILE_MODE_READ) {
+    return FILE_MODE_INVALID;
+  }
+  if (!mapping && file_size) {
+    void *ptr =
+      mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (ptr == MAP_FAILED) {
+      return FILE_MAP_FAILURE;
+    }
+    mapping = ptr;
+  }
+  *data = static_cast<const uint8_t *>(mapping); // nullptr for empty files
+  *size = file_size;
+  return FILE_STATUS_OK;
+}
+
 void File::get_dir(char *path) const {
-  int k = 0; // save last '/'
+  int k = -1; // save last '/'
   for (int i = 0; file_name[i]; i++) {
     path[i] = file_name[i];
     if (file_name[i] == '/')
       k = i;
   }
+  if (k < 0) {
+    // A bare name is in the working directory
+    path[0] = '.';
+    k       = 1;
+  }
   path[k] = '\0';
 }
 
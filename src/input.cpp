@@ -1,6 +1,18 @@
 #include "input.h"
+#include "halloc.h"
 #include "util.h"
 
+Input::Input(File &file, const InputType type) : type(type), file(file) {
+  if (type != InputType::MAPPED)
+    return;
+  // Mapped files are read exactly like strings, without further syscalls
+  const uint8_t *data;
+  if (file.map(&data, &length) != FILE_STATUS_OK) {
+    Logger::fatal("File could not be mapped");
+  }
+  source = reinterpret_cast<const char *>(data);
+}
+
 Input::~Input() = default;
 
 char Input::next() {
@@ -33,12 +45,27 @@ char Input::peek() const {
 
 char Input::current() const { return current_char; }
 
-void Input::read_chunk(
-  char *dest, const size_t start, const size_t length) const {
+void Input::read_chunk(char *dest, size_t start, size_t length) const {
   if (type == InputType::FILE) {
     file.read_chunk(dest, start, length);
     return;
   }
+  if (start > this->length) {
+    start = this->length;
+  }
+  if (length > this->length - start) {
+    length = this->length - start; // never read past the end of a mapping
+  }
   h_memcpy(dest, source + start, length);
   dest[length] = '\0';
 }
+
+const char *Input::view(const size_t start, const size_t length) const {
+  if (type != InputType::FILE) {
+    return source + start;
+  }
+  // Streamed files have no buffer to point into, copy the bytes out
+  const auto dest = static_cast<char *>(halloc(length + 1));
+  file.read_chunk(dest, start, length);
+  return dest;
+}
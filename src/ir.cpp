@@ -0,0 +1,434 @@
+#include "ir.h"
+
+#include <cmath>
+
+uint32_t IrFunction::add(const OpCode op, const uint32_t offset) {
+  IrInstr instr{op, offset};
+  // Operands missing here were left on the VM stack by an earlier statement
+  for (int i = ir_arity(op) - 1; i >= 0 && !stack.empty(); i--) {
+    instr.args[i] = stack.back();
+    stack.pop_back();
+  }
+  const auto value = static_cast<uint32_t>(instrs.size());
+  instrs.push_back(instr);
+  order.push_back(value);
+  if (ir_defines(op))
+    stack.push_back(value);
+  return value;
+}
+
+uint32_t IrFunction::constant(const double value, const uint32_t offset) {
+  const uint32_t id     = add(OpCodes::MOVE, offset);
+  instrs[id].value.f64 = value;
+  return id;
+}
+
+uint32_t IrFunction::load(const uint32_t slot, const uint32_t offset) {
+  const auto value = static_cast<uint32_t>(instrs.size());
+  instrs.push_back({OpCodes::LOAD, offset});
+  instrs.back().value.u32 = slot;
+  order.push_back(value);
+  return value;
+}
+
+uint32_t IrFunction::param(const uint32_t offset) {
+  return load(params++, offset);
+}
+
+uint32_t IrFunction::call(const OpCode op, const Any callee,
+  const uint32_t argc, const uint32_t offset) {
+  IrInstr    instr{op, offset};
+  const auto taken = static_cast<uint32_t>(
+    argc < stack.size() ? argc : stack.size());
+  instr.args[0] = static_cast<uint32_t>(operands.size());
+  instr.args[1] = argc;
+  operands.insert(operands.end(), argc - taken, IR_NONE);
+  operands.insert(operands.end(), stack.end() - taken, stack.end());
+  stack.resize(stack.size() - taken);
+  instr.value = callee;
+
+  const auto value = static_cast<uint32_t>(instrs.size());
+  instrs.push_back(instr);
+  order.push_back(value);
+  stack.push_back(value);
+  return value;
+}
+
+void IrFunction::close(const uint32_t offset) {
+  if (!order.empty() && instrs[order.back()].op == OpCodes::FX_EXIT)
+    return;
+  IrInstr instr{OpCodes::STORE, offset};
+  instr.args[0] = static_cast<uint32_t>(operands.size());
+  operands.insert(operands.end(), stack.begin(), stack.end());
+  stack.clear();
+  homes.clear();
+  for (uint32_t local = 0; local < locals.size(); local++) {
+    const uint32_t value = locals[local];
+    if (value == IR_NONE || (instrs[value].op == OpCodes::LOAD &&
+                              instrs[value].value.u32 == local))
+      continue;
+    operands.push_back(value);
+    homes.push_back(local);
+  }
+  instr.args[1] = static_cast<uint32_t>(operands.size()) - instr.args[0];
+  if (!instr.args[1])
+    return;
+  order.push_back(static_cast<uint32_t>(instrs.size()));
+  instrs.push_back(instr);
+}
+
+void IrFunction::clear() {
+  instrs.clear();
+  order.clear();
+  operands.clear();
+  stack.clear();
+  locals.clear();
+  homes.clear();
+  params = 0;
+}
+
+IrOperands<uint32_t> IrFunction::operands_of(const uint32_t id) {
+  IrInstr &instr = instrs[id];
+  if (ir_variadic(instr.op)) {
+    uint32_t *first = operands.data() + instr.args[0];
+    return {first, first + instr.args[1]};
+  }
+  return {instr.args, instr.args + ir_arity(instr.op)};
+}
+
+IrOperands<const uint32_t> IrFunction::operands_of(const uint32_t id) const {
+  const IrInstr &instr = instrs[id];
+  if (ir_variadic(instr.op)) {
+    const uint32_t *first = operands.data() + instr.args[0];
+    return {first, first + instr.args[1]};
+  }
+  return {instr.args, instr.args + ir_arity(instr.op)};
+}
+
+int ir_arity(const OpCode op) {
+  switch (op) {
+    case OpCodes::ADD:
+    case OpCodes::SUB:
+    case OpCodes::MUL:
+    case OpCodes::DIV:
+    case OpCodes::POW:
+    case OpCodes::L_AND:
+    case OpCodes::L_OR:
+    case OpCodes::B_AND:
+    case OpCodes::B_OR:
+    case OpCodes::B_XOR:
+    case OpCodes::I32_AND:
+    case OpCodes::I32_OR:
+    case OpCodes::I32_XOR:
+    case OpCodes::CMP_EQ:
+    case OpCodes::CMP_NEQ:
+    case OpCodes::CMP_LT:
+    case OpCodes::CMP_LEQ:
+    case OpCodes::CMP_GT:
+    case OpCodes::CMP_GEQ:
+    case OpCodes::RANGE_EXCL:
+    case OpCodes::RANGE_L_IN:
+    case OpCodes::RANGE_R_IN:
+    case OpCodes::RANGE_INCL:
+      return 2;
+    case OpCodes::NEGATE:
+    case OpCodes::NOT:
+    case OpCodes::B_NOT:
+    case OpCodes::I32_NOT:
+    case OpCodes::RETURN:
+    case OpCodes::POP:
+    case OpCodes::FX_EXIT:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+bool ir_variadic(const OpCode op) {
+  return op == OpCodes::CALL || op == OpCodes::CALL_EXT ||
+         op == OpCodes::STORE;
+}
+
+bool ir_defines(const OpCode op) {
+  switch (op) {
+    case OpCodes::RETURN:
+    case OpCodes::STORE:
+    case OpCodes::POP:
+    case OpCodes::FX_ENTRY:
+    case OpCodes::FX_EXIT:
+      return false;
+    default:
+      return true;
+  }
+}
+
+bool ir_pure(const OpCode op) {
+  switch (op) {
+    case OpCodes::MOVE:
+    case OpCodes::ADD:
+    case OpCodes::SUB:
+    case OpCodes::MUL:
+    case OpCodes::DIV:
+    case OpCodes::POW:
+    case OpCodes::L_AND:
+    case OpCodes::L_OR:
+    case OpCodes::NEGATE:
+    case OpCodes::NOT:
+    case OpCodes::I32_AND:
+    case OpCodes::I32_OR:
+    case OpCodes::I32_XOR:
+    case OpCodes::I32_NOT:
+    case OpCodes::CMP_EQ:
+    case OpCodes::CMP_NEQ:
+    case OpCodes::CMP_LT:
+    case OpCodes::CMP_LEQ:
+    case OpCodes::CMP_GT:
+    case OpCodes::CMP_GEQ:
+    case OpCodes::LOAD: // of a slot nothing in the block stores to
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Pure and not reading anything an earlier statement left on the stack
+static bool removable(const IrInstr &instr) {
+  if (!ir_pure(instr.op))
+    return false;
+  for (int i = 0; i < ir_arity(instr.op); i++) {
+    if (instr.args[i] == IR_NONE)
+      return false;
+  }
+  return true;
+}
+
+// Same results as the VM, which runs the unoptimized code
+static double evaluate(const OpCode op, const double a, const double b) {
+  switch (op) {
+    case OpCodes::ADD:
+      return a + b;
+    case OpCodes::SUB:
+      return a - b;
+    case OpCodes::MUL:
+      return a * b;
+    case OpCodes::DIV:
+      return a / b;
+    case OpCodes::POW:
+      return pow(a, b);
+    case OpCodes::L_AND:
+      return a && b;
+    case OpCodes::L_OR:
+      return a || b;
+    case OpCodes::NEGATE:
+      return -a;
+    case OpCodes::NOT:
+      return !static_cast<bool>(a);
+    case OpCodes::I32_AND:
+      return i32_bits(a) & i32_bits(b);
+    case OpCodes::I32_OR:
+      return i32_bits(a) | i32_bits(b);
+    case OpCodes::I32_XOR:
+      return i32_bits(a) ^ i32_bits(b);
+    case OpCodes::I32_NOT:
+      return ~i32_bits(a);
+    case OpCodes::CMP_EQ:
+      return a == b;
+    case OpCodes::CMP_NEQ:
+      return a != b;
+    case OpCodes::CMP_LT:
+      return a < b;
+    case OpCodes::CMP_LEQ:
+      return a <= b;
+    case OpCodes::CMP_GT:
+      return a > b;
+    case OpCodes::CMP_GEQ:
+      return a >= b;
+    default:
+      return 0;
+  }
+}
+
+static void fold_constants(IrFunction &function) {
+  for (const uint32_t id : function.order) {
+    IrInstr  &instr = function.instrs[id];
+    const int arity = ir_arity(instr.op);
+    // Constants and parameters are as folded as they get
+    if (!arity || !removable(instr))
+      continue;
+    double operands[2] = {};
+    bool   constant    = true;
+    for (int i = 0; i < arity && constant; i++) {
+      const IrInstr &arg = function.instrs[instr.args[i]];
+      constant           = arg.op == OpCodes::MOVE;
+      operands[i]        = arg.value.f64;
+    }
+    if (!constant)
+      continue;
+    instr.value.f64 = evaluate(instr.op, operands[0], operands[1]);
+    instr.op        = OpCodes::MOVE;
+    instr.args[0]   = IR_NONE;
+    instr.args[1]   = IR_NONE;
+  }
+}
+
+static bool commutes(const OpCode op) {
+  return op == OpCodes::ADD || op == OpCodes::MUL || op == OpCodes::L_AND ||
+         op == OpCodes::L_OR || op == OpCodes::I32_AND ||
+         op == OpCodes::I32_OR || op == OpCodes::I32_XOR ||
+         op == OpCodes::CMP_EQ || op == OpCodes::CMP_NEQ;
+}
+
+static bool same_operation(const IrInstr &a, const IrInstr &b) {
+  if (a.op != b.op)
+    return false;
+  if (a.op == OpCodes::MOVE || a.op == OpCodes::LOAD)
+    return a.value.u64 == b.value.u64;
+  if (a.args[0] == b.args[0] && a.args[1] == b.args[1])
+    return true;
+  return commutes(a.op) && a.args[0] == b.args[1] && a.args[1] == b.args[0];
+}
+
+static size_t operation_hash(const IrInstr &instr) {
+  uint32_t a = instr.args[0];
+  uint32_t b = instr.args[1];
+  if (commutes(instr.op) && a > b) {
+    const uint32_t swap = a;
+    a                   = b;
+    b                   = swap;
+  }
+  size_t hash = static_cast<size_t>(instr.op);
+  if (instr.op == OpCodes::MOVE || instr.op == OpCodes::LOAD)
+    hash ^= instr.value.u64;
+  hash        = hash * 0x9E3779B97F4A7C15ULL + a;
+  hash        = hash * 0x9E3779B97F4A7C15ULL + b;
+  return hash ^ hash >> 29;
+}
+
+// Value numbering: a pure operation on the same operands as an earlier one is
+// replaced by it. Equal constants are merged so that operations on them compare
+// equal, lowering moves a shared constant again for every use anyway.
+static void merge_common(IrFunction &function) {
+  std::vector<uint32_t> replacement(function.instrs.size());
+  for (uint32_t id = 0; id < replacement.size(); id++)
+    replacement[id] = id;
+
+  size_t capacity = 16;
+  while (capacity < function.order.size() * 2)
+    capacity <<= 1;
+  std::vector<uint32_t> table(capacity, IR_NONE);
+
+  for (const uint32_t id : function.order) {
+    for (uint32_t &arg : function.operands_of(id)) {
+      if (arg != IR_NONE)
+        arg = replacement[arg];
+    }
+    const IrInstr &instr = function.instrs[id];
+    if (removable(instr)) {
+      for (size_t slot = operation_hash(instr) & (capacity - 1);;
+           slot        = (slot + 1) & (capacity - 1)) {
+        const uint32_t other = table[slot];
+        if (other == IR_NONE) {
+          table[slot] = id;
+          break;
+        }
+        if (!same_operation(function.instrs[other], instr))
+          continue;
+        replacement[id] = other;
+        break;
+      }
+    }
+  }
+}
+
+// Whatever no impure instruction depends on goes
+static void remove_dead(IrFunction &function) {
+  std::vector<bool> live(function.instrs.size());
+  for (size_t p = function.order.size(); p-- > 0;) {
+    const uint32_t id    = function.order[p];
+    const IrInstr &instr = function.instrs[id];
+    if (!removable(instr))
+      live[id] = true;
+    if (!live[id])
+      continue;
+    for (const uint32_t arg : function.operands_of(id)) {
+      if (arg != IR_NONE)
+        live[arg] = true;
+    }
+  }
+
+  size_t kept = 0;
+  for (const uint32_t id : function.order) {
+    if (live[id])
+      function.order[kept++] = id;
+  }
+  function.order.resize(kept);
+}
+
+const char *ir_inline_blocker(const IrFunction &body) {
+  uint32_t size = 0;
+  for (const uint32_t id : body.order) {
+    const IrInstr &instr = body.instrs[id];
+    if (instr.op == OpCodes::LOAD || instr.op == OpCodes::FX_EXIT)
+      continue;
+    for (const uint32_t arg : body.operands_of(id)) {
+      if (arg == IR_NONE)
+        return "it reads values it did not define";
+    }
+    size++;
+  }
+  return size > IR_INLINE_BUDGET ? "it is too large" : nullptr;
+}
+
+// Parameters become the arguments and the result what the body returns, the
+// instructions left are copied with their operands renamed. Locals of the
+// body were values already, the allocator gives them slots of the caller.
+// The copies take the position of the call, which is where they now run.
+void ir_inline(IrFunction &function, const IrFunction &body,
+  const uint32_t argc, const uint32_t offset) {
+  const std::vector<uint32_t> args(function.stack.end() - argc,
+    function.stack.end());
+  function.stack.resize(function.stack.size() - argc);
+
+  std::vector<uint32_t> renamed(body.instrs.size(), IR_NONE);
+  uint32_t              result = IR_NONE;
+  for (const uint32_t id : body.order) {
+    IrInstr instr = body.instrs[id];
+    if (instr.op == OpCodes::LOAD) {
+      renamed[id] = args[instr.value.u32];
+      continue;
+    }
+    if (instr.op == OpCodes::FX_EXIT) {
+      if (instr.args[0] != IR_NONE)
+        result = renamed[instr.args[0]];
+      continue;
+    }
+    if (ir_variadic(instr.op)) {
+      const auto first = static_cast<uint32_t>(function.operands.size());
+      for (const uint32_t arg : body.operands_of(id))
+        function.operands.push_back(renamed[arg]);
+      instr.args[0] = first;
+    } else {
+      for (int i = 0; i < ir_arity(instr.op); i++)
+        instr.args[i] = renamed[instr.args[i]];
+    }
+    instr.offset = offset;
+    renamed[id]  = static_cast<uint32_t>(function.instrs.size());
+    function.instrs.push_back(instr);
+    function.order.push_back(renamed[id]);
+  }
+
+  // A body that leaves nothing returns 0
+  if (result == IR_NONE)
+    function.constant(0, offset);
+  else
+    function.stack.push_back(result);
+}
+
+void optimize(IrFunction &function, const int level) {
+  if (level < 1)
+    return;
+  fold_constants(function);
+  if (level >= 2)
+    merge_common(function);
+  remove_dead(function);
+}
@@ -1,131 +1,43 @@
 #include "lexer.h"
-#include "halloc.h"
-
-#include <cmath>
+#include "keyword.h"
+#include "number.h"
+#include "scan.h"
+#include "unicode.h"
 
 void Lexer::reset(const Input &input) {
-  this->input  = input;
-  end          = false;
-  had_float    = false;
-  current_char = '\0';
-  next_char    = this->input.next();
-  iterator     = -1;
-  character    = 1;
-  line         = 1;
-  start        = 0;
-  absStart     = 0;
+  this->input    = input;
+  end            = false;
+  had_float      = false;
+  failed         = false;
+  constant_index = 0;
+  current_char   = '\0';
+  next_char      = this->input.next();
+  iterator       = -1;
+  absStart       = 0;
+  newlines       = 0;
+  token_lines    = 0;
+  last_lines     = 0;
 }
 
 static bool isDec(const char c) { return c >= '0' && c <= '9'; }
 
-static bool isHex(const char c) {
-  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
-         (c >= 'A' && c <= 'F');
-}
-
 static bool isAlpha(const char c) {
   return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '$' ||
          c == '_';
 }
 
-Type keyword(const char *k) {
-  switch (k[0]) {
-    case 'a':
-      if (k[1] == 's') {
-        if (k[2] == '\0')
-          return Types::AS;
-        if (k[2] == 'y' && k[3] == 'n' && k[4] == 'c' && k[5] == '\0')
-          return Types::ASYNC;
-      }
-      if (k[1] == 'w' && k[2] == 'a' && k[3] == 'i' && k[4] == 't' &&
-          k[5] == '\0')
-        return Types::AWAIT;
-      return Types::NAME;
-    case 'c':
-      if (k[1] == 'a' && k[2] == 's' && k[3] == 'e' && k[4] == '\0')
-        return Types::CASE;
-      if (k[1] == 'l' && k[2] == 'a' && k[3] == 's' && k[4] == 's' &&
-          k[5] == '\0')
-        return Types::CLASS;
-      return Types::NAME;
-    case 'd':
-      if (k[1] == 'e' && k[2] == 'f' && k[3] == 'a' && k[4] == 'u' &&
-          k[5] == 'l' && k[6] == 't' && k[7] == '\0')
-        return Types::DEFAULT;
-      if (k[1] == 'o' && k[2] == '\0')
-        return Types::DO;
-      return Types::NAME;
-    case 'e':
-      if (k[1] == 'l' && k[2] == 's' && k[3] == 'e' && k[4] == '\0')
-        return Types::ELSE;
-      return Types::NAME;
-    case 'f':
-      if (k[1] == 'a' && k[2] == 'l' && k[3] == 's' && k[4] == 'e' &&
-          k[5] == '\0')
-        return Types::FALSE;
-      if (k[1] == 'o' && k[2] == 'r' && k[3] == '\0')
-        return Types::FOR;
-      if (k[1] == 'r' && k[2] == 'o' && k[3] == 'm' && k[4] == '\0')
-        return Types::FROM;
-      if (k[1] == 'x' && k[2] == '\0')
-        return Types::FX;
-      return Types::NAME;
-    case 'i':
-      if (k[1] == 'f' && k[2] == '\0')
-        return Types::IF;
-      if (k[1] == 'm' && k[2] == 'p' && k[3] == 'o' && k[4] == 'r' &&
-          k[5] == 't' && k[6] == '\0')
-        return Types::IMPORT;
-      return Types::NAME;
-    case 'n':
-      if (k[1] == 'e' && k[2] == 'w' && k[3] == '\0')
-        return Types::NEW;
-      if (k[1] == 'u' && k[2] == 'l' && k[3] == 'l' && k[4] == '\0')
-        return Types::NUL;
-      return Types::NAME;
-    case 'r':
-      if (k[1] == 'e' && k[2] == 't' && k[3] == 'u' && k[4] == 'r' &&
-          k[5] == 'n' && k[6] == '\0')
-        return Types::RETURN;
-      return Types::NAME;
-    case 's':
-      if (k[1] == 'e' && k[2] == 'l' && k[3] == 'e' && k[4] == 'c' &&
-          k[5] == 't' && k[6] == '\0')
-        return Types::SELECT;
-      if (k[1] == 'w' && k[2] == 'i' && k[3] == 't' && k[4] == 'c' &&
-          k[5] == 'h' && k[6] == '\0')
-        return Types::SWITCH;
-      return Types::NAME;
-    case 't':
-      if (k[1] == 'r' && k[2] == 'u' && k[3] == 'e' && k[4] == '\0')
-        return Types::TRUE;
-      return Types::NAME;
-    case 'w':
-      if (k[1] == 'h' && k[2] == 'i' && k[3] == 'l' && k[4] == 'e' &&
-          k[5] == '\0')
-        return Types::WHILE;
-      return Types::NAME;
-    default:
-      return Types::NAME;
-  }
-}
-
 char Lexer::next() {
   if (end) {
     return '\0';
   }
   current_char = next_char;
   next_char    = input.next(); // save the next char for peeking
-  character++;
   iterator++;
   if (current_char == '\0') {
     end = true;
     return current_char;
   }
-  if (current_char == '\n') {
-    line++;
-    character = 1;
-  }
+  newlines += current_char == '\n';
   return current_char;
 }
 
@@ -142,329 +54,186 @@ bool Lexer::match(const char c) {
   return false;
 }
 
-static uint8_t constant_index = 0;
+// Consumes `count` characters at once
+void Lexer::skip(const size_t count) {
+  if (!count)
+    return;
+  if (!input.data()) {
+    for (size_t i = 0; i < count; i++)
+      next();
+    return;
+  }
+  const char *skipped = input.data() + iterator + 1;
+  newlines += static_cast<uint32_t>(scanner.count(skipped, count, '\n'));
+  iterator += static_cast<int>(count);
+  current_char = input.data()[iterator];
+  input.seek(iterator + 1);
+  next_char = input.next();
+}
+
+void Lexer::seek(
+  const size_t offset, const bool after_float, const bool after_break) {
+  end          = false;
+  had_float    = after_float;
+  iterator     = static_cast<int>(offset) - 1;
+  current_char = offset ? input.data()[offset - 1] : '\0';
+  input.seek(offset);
+  next_char   = input.next();
+  newlines    = after_break;
+  token_lines = 0;
+  last_lines  = 0;
+}
+
+// The skip_* helpers stop right before the first character that does not
+// belong to the run, streamed sources fall back to one character at a time
+
+void Lexer::skip_space() {
+  if (const char *source = input.data()) {
+    const size_t offset = iterator + 1;
+    skip(scanner.space(source + offset, input.size() - offset));
+  }
+}
+
+void Lexer::skip_ident() {
+  if (const char *source = input.data()) {
+    const size_t offset = iterator + 1;
+    skip(scanner.ident(source + offset, input.size() - offset));
+    return;
+  }
+  while (isAlpha(peek()) || isDec(peek()))
+    next();
+}
+
+void Lexer::skip_until(const char a, const char b, const char c) {
+  if (const char *source = input.data()) {
+    const size_t offset = iterator + 1;
+    skip(scanner.find(source + offset, input.size() - offset, a, b, c));
+    return;
+  }
+  while (peek() != '\0' && peek() != a && peek() != b && peek() != c)
+    next();
+}
 
 // function to create a token
 Token Lexer::emit(const Type type) {
   Token token{};
 
-  token.type         = type;
-  token.pos.start    = start;
-  token.pos.absStart = absStart;
-  token.pos.end      = character;
-  token.pos.absEnd   = iterator + 1;
-  token.pos.line     = line;
-
-  switch (type) {
-    case Types::STR: {
-      const size_t len = token.pos.absEnd - token.pos.absStart;
-      token.value.ptr  = halloc(len - 1);
-      token.index      = constant_index++;
-      input.read_chunk(
-        static_cast<char *>(token.value.ptr), token.pos.absStart + 1, len - 2);
-      break;
-    }
-    case Types::NAME: {
-      const size_t len = token.pos.absEnd - token.pos.absStart;
-      token.value.ptr  = halloc(len + 1);
-      input.read_chunk(
-        static_cast<char *>(token.value.ptr), token.pos.absStart, len);
-      break;
-    }
-    case Types::DEC: {
-#define MAX_NUMBER_LENGTH 0x40
-      char buffer[MAX_NUMBER_LENGTH];
-      input.read_chunk(buffer, token.pos.absStart, MAX_NUMBER_LENGTH);
-#undef MAX_NUMBER_LENGTH
-      token.value.f64 = strtod(buffer, nullptr);
-      token.index     = constant_index++;
-      break;
-    }
-    case Types::OCTAL: {
-#define MAX_NUMBER_LENGTH 0x40
-      char buffer[MAX_NUMBER_LENGTH];
-      input.read_chunk(buffer, token.pos.absStart, MAX_NUMBER_LENGTH);
-    }
-    default:
-      had_float = false;
-      break;
-  }
+  token.type   = type;
+  token.offset = static_cast<uint32_t>(absStart);
+  token.length = static_cast<uint32_t>(iterator + 1 - absStart);
+  if (token_lines != last_lines)
+    token.flags = TOKEN_NEWLINE;
+  last_lines = token_lines;
+
+  if (type == Types::STR)
+    token.payload = constant_index++;
+  // Only a number right before can turn a following '...' into a range
+  had_float = false;
 
   // Logger::print_token(token);
 
   return token;
 }
 
-Token Lexer::emit(const Type type, const double value) const {
-  Token token;
-
-  token.type         = type;
-  token.pos.start    = start;
-  token.pos.absStart = absStart;
-  token.pos.end      = character;
-  token.pos.absEnd   = iterator + 1;
-  token.pos.line     = line;
-  token.value.f64    = value;
-
-  // Logger::print_token(token);
+// Streamed sources have no buffer to scan in place, a bounded window of the
+// file is scanned instead
+#define MAX_NUMBER_LENGTH 0x100
+
+Token Lexer::number() {
+  NumberLiteral literal;
+  if (const char *source = input.data()) {
+    literal = scan_number(source + absStart, input.size() - absStart);
+  } else {
+    char buffer[MAX_NUMBER_LENGTH + 1];
+    input.read_chunk(buffer, absStart, MAX_NUMBER_LENGTH);
+    literal = scan_number(buffer, h_strnlen(buffer, MAX_NUMBER_LENGTH));
+    if (literal.length >= MAX_NUMBER_LENGTH)
+      return fail("Number literal too long");
+  }
 
+  // the first character has already been consumed
+  skip(literal.length - 1);
+  const Token token = emit(literal.type);
+  had_float         = literal.dotted;
   return token;
 }
 
-Token Lexer::number(const char first_char) {
-  // Tested approaches:
-  // . switch + bitfield
-  // . switch + booleans
-  // . if branching
-  // This one has proved to be the fastest.
+double Lexer::value(const Token &token) const {
+  if (const char *source = input.data())
+    return scan_number(source + token.offset, token.length).value;
+  char buffer[MAX_NUMBER_LENGTH + 1];
+  input.read_chunk(buffer, token.offset, token.length);
+  return scan_number(buffer, token.length).value;
+}
 
-  double  value     = 0;
-  double  loose     = 0;
-  double  exponent  = 0;
-  double  base      = 10;
-  uint8_t float_idx = 0;
+#undef MAX_NUMBER_LENGTH
 
-  had_float      = false;
-  bool done      = false;
-  bool had_exp   = false;
-  bool is_hex    = false;
-  bool is_binary = false;
-  bool is_octal  = false;
-  bool oct_loose = false;
-  bool set_type  = false;
-  bool had_value = false;
-  bool had_under = false;
-
-  bool is_exp_neg = false;
-
-#define insert(x)                                                              \
-  if (is_binary || is_octal)                                                   \
-    value = value * base + x;                                                  \
-  else if (had_exp)                                                            \
-    exponent = exponent * base + x;                                            \
-  else if (had_float)                                                          \
-    value += (x) * (1.0 / pow(base, ++float_idx));                             \
-  else                                                                         \
-    value = value * base + x;
-#define insert_hex(x)                                                          \
-  if (had_float)                                                               \
-    value += (x) * (1.0 / pow(base, ++float_idx));                             \
-  else                                                                         \
-    value = value * 16 + x;
-#define insert_octal(x)                                                        \
-  if (oct_loose)                                                               \
-    loose = loose * 8 + x;
-
-  switch (first_char) {
-    case '.':
-      had_float = true;
-      break;
-    case '0':
-      set_type  = true;
-      oct_loose = true;
-      if (isDec(peek()))
-        had_under = true;
-      break;
-    case '1':
-    case '2':
-    case '3':
-    case '4':
-    case '5':
-    case '6':
-    case '7':
-    case '8':
-    case '9':
-      had_value = true;
-      value     = first_char - '0';
-      break;
-    default:
-      return emit(Types::ERROR);
+// Decodes the character at `offset`, 0 bytes long when it is not UTF-8
+size_t Lexer::decode(const size_t offset, uint32_t *code_point) const {
+  if (const char *source = input.data())
+    return utf8_decode(source + offset, input.size() - offset, code_point);
+  char buffer[5];
+  input.read_chunk(buffer, offset, 4);
+  return utf8_decode(buffer, h_strnlen(buffer, 4), code_point);
+}
+
+// Streamed sources are checked in pieces, a sequence cut off at the end of
+// one is checked again at the start of the next
+#define UTF8_CHUNK 0x100
+
+// Strings and comments may hold any text, as long as it is valid UTF-8
+bool Lexer::valid_utf8(const size_t from, const size_t to) const {
+  if (const char *source = input.data())
+    return scanner.utf8(source + from, to - from) == to - from;
+  char buffer[UTF8_CHUNK + 1];
+  for (size_t offset = from; offset < to;) {
+    const size_t length = to - offset < UTF8_CHUNK ? to - offset : UTF8_CHUNK;
+    input.read_chunk(buffer, offset, length);
+    const size_t valid = scanner.utf8(buffer, length);
+    if (valid < length && (offset + length == to || length - valid > 3))
+      return false;
+    offset += valid;
   }
+  return true;
+}
 
+#undef UTF8_CHUNK
+
+// Names are made of ASCII letters, digits, '_' and '$' or of Unicode
+// identifier characters. ASCII runs are skipped in bulk, anything else is
+// decoded one character at a time. Keywords are all ASCII.
+Token Lexer::identifier(bool ascii) {
   for (;;) {
-    switch (const char c = peek()) {
-      case '0':
-        had_value = true;
-        insert(0);
-        insert_octal(0);
-        next();
-        break;
-      case '1':
-        had_value = true;
-        had_under = false;
-        insert(1);
-        insert_octal(1);
-        next();
-        break;
-      case '2':
-      case '3':
-      case '4':
-      case '5':
-      case '6':
-      case '7':
-        if (is_binary)
-          return emit(Types::ERROR);
-        had_value = true;
-        had_under = false;
-        insert(c - '0');
-        insert_octal(c - '0');
-        next();
-        break;
-      case '8':
-      case '9':
-        if (is_binary)
-          return emit(Types::ERROR);
-        if (is_octal)
-          return emit(Types::ERROR);
-        had_value = true;
-        had_under = false;
-        oct_loose = false;
-        insert(c - '0');
-        next();
-        break;
-      case 'a':
-      case 'c':
-      case 'd':
-      case 'f':
-        if (!is_hex || had_exp)
-          return emit(Types::ERROR);
-        had_value = true;
-        had_under = false;
-        insert_hex(c - 'a' + 10);
-        next();
-        break;
-      case 'A':
-      case 'C':
-      case 'D':
-      case 'F':
-        if (!is_hex || had_exp)
-          return emit(Types::ERROR);
-        had_value = true;
-        had_under = false;
-        insert_hex(c - 'A' + 10);
-        next();
-        break;
-      case 'b':
-      case 'B':
-        if (is_hex) {
-          had_value = true;
-          had_under = false;
-          insert_hex(11);
-          next();
-          break;
-        }
-        if (!set_type)
-          return emit(Types::ERROR);
-        set_type  = false;
-        oct_loose = false;
-        is_binary = true;
-        base      = 2;
-        had_exp   = true; // binary number cannot have exponent
-        had_float = true; // binary number cannot have floating point
-        next();
-        break;
-      case 'o':
-      case 'O':
-        if (!set_type)
-          return emit(Types::ERROR);
-        set_type  = false;
-        oct_loose = false;
-        is_octal  = true;
-        base      = 8;
-        had_exp   = true; // octal number cannot have exponent
-        had_float = true; // octal number cannot have floating point
-        next();
-        break;
-      case 'x':
-      case 'X':
-        if (!set_type)
-          return emit(Types::ERROR);
-        set_type  = false;
-        oct_loose = false;
-        is_hex    = true;
-        base      = 16;
-        next();
-        if (!isHex(peek()) && peek() != '.')
-          return emit(Types::ERROR);
-        break;
-      case '.':
-        if (peek2() == '.') {
-          done = true;
-          break;
-        }
-        if (is_binary)
-          return emit(Types::ERROR);
-        if (had_float)
-          return emit(Types::ERROR);
-        next();
-        if (!had_value && !isHex(peek()))
-          return emit(Types::ERROR);
-        had_float = true;
-        oct_loose = false;
-        break;
-      case 'e':
-      case 'E':
-        if (is_hex) {
-          had_value = true;
-          insert_hex(14);
-          next();
-          break;
-        }
-        if (had_exp)
-          return emit(Types::ERROR);
-        next();
-        if (match('+') || match('-'))
-          is_exp_neg = current() == '-';
-        if (!isDec(peek()))
-          return emit(Types::ERROR);
-        had_exp   = true;
-        oct_loose = false;
-        break;
-      case 'p':
-      case 'P':
-        if (!is_hex || had_exp)
-          return emit(Types::ERROR);
-        had_exp = true;
-        next();
-        if (match('+') || match('-'))
-          is_exp_neg = current() == '-';
-        if (!isDec(peek()))
-          return emit(Types::ERROR);
-        break;
-      case '_':
-      case '\'':
-        if (had_under)
-          return emit(Types::ERROR);
-        had_under = true;
-        next();
-        break;
-      default:
-        done = true;
-        break;
-    }
-    if (done)
+    skip_ident();
+    if (!(peek() & 0x80))
+      break;
+    uint32_t     code_point;
+    const size_t length = decode(iterator + 1, &code_point);
+    if (!length || !is_ident_continue(code_point))
       break;
+    skip(length);
+    ascii = false;
   }
 
-  if (had_under)
-    return emit(Types::ERROR);
-  if (is_hex && had_float && !had_exp)
-    return emit(Types::ERROR);
-
-  if (is_exp_neg)
-    value /= pow(is_hex ? 2.0 : 10.0, exponent);
-  else
-    value *= pow(is_hex ? 2.0 : 10.0, exponent);
-
-  if (is_hex)
-    return emit(Types::HEX, value);
-  if (is_binary)
-    return emit(Types::BINARY, value);
-  if (is_octal)
-    return emit(Types::OCTAL, value);
-  if (oct_loose)
-    return emit(Types::OCTAL, loose);
-  return emit(Types::DEC, value);
+  const size_t len = iterator + 1 - absStart;
+  if (!ascii)
+    return emit(Types::NAME);
+  if (const char *source = input.data())
+    return emit(keyword(source + absStart, len));
+  if (len > MAX_KEYWORD_LENGTH)
+    return emit(Types::NAME);
+  char buffer[MAX_KEYWORD_LENGTH + 1];
+  input.read_chunk(buffer, absStart, len);
+
+  return emit(keyword(buffer, len));
+}
+
+Token Lexer::fail(const char *message) {
+  if (!soft_errors)
+    Logger::fatal(message);
+  failed = true;
+  end    = true;
+  return emit(Types::END);
 }
 
 Token Lexer::advance() {
@@ -472,15 +241,15 @@ Token Lexer::advance() {
     return emit(Types::END);
 
   for (;;) {
+    token_lines  = newlines;
     const char c = next();
-    start        = character - 1;
     absStart     = iterator;
     switch (c) {
       case '@':
         return emit(Types::AT);
       case '.':            // .
         if (isDec(peek())) // float
-          return number('.');
+          return number();
         if (match('.')) { // ..
           if (match('=')) // ..=
             return emit(Types::RANGE_R_IN);
@@ -530,6 +299,7 @@ Token Lexer::advance() {
       case ' ':
       case '\t':
       case '\r':
+        skip_space();
         continue;
       case '+':
         if (match('='))
@@ -579,13 +349,20 @@ Token Lexer::advance() {
         return emit(Types::CARET);
       case '/':
         if (match('/')) {
-          while (peek() != '\0' && peek() != '\n')
-            next();
+          skip_until('\n', '\n', '\n');
+          if (!valid_utf8(absStart, iterator + 1))
+            return fail("Invalid UTF-8");
           continue;
         }
         if (match('*')) {
-          while (peek() != '\0' && !match('*') && !match('/'))
+          while (peek() != '\0') {
+            skip_until('*', '*', '*');
             next();
+            if (match('/'))
+              break;
+          }
+          if (!valid_utf8(absStart, iterator + 1))
+            return fail("Invalid UTF-8");
           continue;
         }
         return emit(Types::DIV);
@@ -619,77 +396,60 @@ Token Lexer::advance() {
         if (match('='))
           return emit(Types::REM_EQ);
         return emit(Types::REM);
-      case '"': {
-        bool err = false;
-        while (peek() != '"') {
-          if (peek() == '\n') {
-            err = true;
+      case '"':
+      case '\'': {
+        // single line strings, escaped newlines are allowed
+        for (;;) {
+          skip_until(c, '\\', '\n');
+          if (peek() != '\\')
             break;
-          }
-          if (peek() == '\\')
-            next();
+          next();
           next();
         }
-        if (err)
-          Logger::fatal("Unterminated string");
+        if (peek() != c)
+          return fail("Unterminated string");
 
         next();
+        if (!valid_utf8(absStart, iterator + 1))
+          return fail("Invalid UTF-8");
         return emit(Types::STR);
       }
       case '`': {
         // multiline strings
-        while (peek() != '`') {
-          if (peek() == '\\')
-            next();
-          next();
-        }
-        next();
-        return emit(Types::STR);
-      }
-      case '\'': {
-        bool err = false;
-        while (peek() != '\'') {
-          if (peek() == '\n') {
-            err = true;
+        for (;;) {
+          skip_until('`', '\\', '`');
+          if (peek() != '\\')
             break;
-          }
-          if (peek() == '\\')
-            next();
+          next();
           next();
         }
-        if (err)
-          Logger::fatal("Unterminated string");
+        if (peek() != '`')
+          return fail("Unterminated string");
 
         next();
+        if (!valid_utf8(absStart, iterator + 1))
+          return fail("Invalid UTF-8");
         return emit(Types::STR);
       }
 
       default: {
         if (isDec(current()))
-          return number(current());
-
-        if (isAlpha(current())) {
-          // matching keywords and names
-
-          while (isAlpha(peek()) || isDec(peek()))
-            next();
-          const int len = iterator + 1 - absStart;
-          char      buffer[0xFF]; // max length of 255
-          input.read_chunk(buffer, absStart, len);
-          buffer[len] = '\0';
-
-          return emit(keyword(buffer));
+          return number();
+
+        if (isAlpha(current()))
+          return identifier(true);
+
+        if (current() & 0x80) {
+          uint32_t     code_point;
+          const size_t length = decode(iterator, &code_point);
+          if (!length)
+            return fail("Invalid UTF-8");
+          if (is_ident_start(code_point)) {
+            skip(length - 1);
+            return identifier(false);
+          }
         }
-
-        // Parse UTF8 characters
-        // if ((current() & 0xe0) == 0xc0)
-        //   next();
-        // else if ((current() & 0xf0) == 0xe0)
-        //   next(); next();
-        // else if ((current() & 0xf8) == 0xf0)
-        //   next(); next(); next();
-        // Token t = emit(UNDEF);
-        Logger::fatal("Unexpected token");
+        return fail("Unexpected token");
       }
     }
   }
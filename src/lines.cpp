@@ -0,0 +1,203 @@
+#include "lines.h"
+#include "input.h"
+#include "logger.h"
+#include "scan.h"
+
+#include <algorithm>
+
+static int put_varint(uint8_t *dst, uint32_t value) {
+  int n = 0;
+  while (value >= 0x80) {
+    dst[n++] = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  dst[n++] = static_cast<uint8_t>(value);
+  return n;
+}
+
+static uint32_t get_varint(const uint8_t *src, int *offset, const int size) {
+  uint32_t value = 0;
+  for (int shift = 0; *offset < size && shift < 32; shift += 7) {
+    const uint8_t byte = src[(*offset)++];
+    value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      break;
+  }
+  return value;
+}
+
+static uint32_t zigzag(const int value) {
+  return static_cast<uint32_t>(value) << 1 ^ static_cast<uint32_t>(value >> 31);
+}
+
+static int unzigzag(const uint32_t value) {
+  return static_cast<int>(value >> 1) ^ -static_cast<int>(value & 1);
+}
+
+void LineTable::add(const int pc, const int line, const int column) {
+  if (line == last_line && column == last_column)
+    return;
+
+  if (size && pc == last_pc) {
+    // A later position for the same instruction replaces the earlier one
+    size = last_entry;
+  } else {
+    base_pc   = last_pc;
+    base_line = last_line;
+  }
+
+  // Three varints of at most five bytes each
+  if (size + 15 > MAX_LINE_TABLE)
+    Logger::fatal("Line table overflow");
+
+  last_entry = size;
+  size += put_varint(data + size, static_cast<uint32_t>(pc - base_pc));
+  size += put_varint(data + size, zigzag(line - base_line));
+  size += put_varint(data + size, static_cast<uint32_t>(column));
+  last_pc     = pc;
+  last_line   = line;
+  last_column = column;
+}
+
+bool LineTable::load(const uint8_t *table, const size_t length) {
+  if (length > MAX_LINE_TABLE)
+    return false;
+  clear();
+  h_memcpy(data, table, length);
+  size = static_cast<int>(length);
+  // Restore the encoder state so the table can keep growing
+  for (int offset = 0; offset < size;) {
+    last_entry = offset;
+    base_pc    = last_pc;
+    base_line  = last_line;
+    last_pc += static_cast<int>(get_varint(data, &offset, size));
+    last_line += unzigzag(get_varint(data, &offset, size));
+    last_column = static_cast<int>(get_varint(data, &offset, size));
+  }
+  return true;
+}
+
+void LineTable::append(const uint8_t *table, const size_t length,
+  const int pc_offset, const int line_offset) {
+  const auto end  = static_cast<int>(length);
+  int        pc   = 0;
+  int        line = 0;
+  for (int offset = 0; offset < end;) {
+    pc += static_cast<int>(get_varint(table, &offset, end));
+    line += unzigzag(get_varint(table, &offset, end));
+    const auto column = static_cast<int>(get_varint(table, &offset, end));
+    add(pc + pc_offset, line + line_offset, column);
+  }
+}
+
+void LineTable::clear() {
+  size        = 0;
+  last_entry  = 0;
+  base_pc     = 0;
+  base_line   = 0;
+  last_pc     = 0;
+  last_line   = 0;
+  last_column = -1;
+}
+
+bool LineTable::find(const int pc, int *line, int *column) const {
+  int  entry_pc   = 0;
+  int  entry_line = 0;
+  bool found      = false;
+  for (int offset = 0; offset < size;) {
+    entry_pc += static_cast<int>(get_varint(data, &offset, size));
+    if (entry_pc > pc)
+      break;
+    entry_line += unzigzag(get_varint(data, &offset, size));
+    *line   = entry_line;
+    *column = static_cast<int>(get_varint(data, &offset, size));
+    found   = true;
+  }
+  return found;
+}
+
+// Appends the start of every line after the first one in `s[0..n)`
+static void find_lines(std::vector<uint32_t> &starts, const char *s,
+  const size_t n, const size_t base) {
+  for (size_t i = 0; (i += scanner.find(s + i, n - i, '\n', '\n', '\n')) < n;)
+    starts.push_back(static_cast<uint32_t>(base + ++i));
+}
+
+void LineIndex::build(const char *source, const size_t length) {
+  std::vector<uint32_t> found{0};
+  find_lines(found, source, length, 0);
+  starts = GapList<uint32_t, LinePlace>(std::move(found));
+  end    = length;
+  hint   = 0;
+}
+
+// Streamed files are read once more in large pieces
+#define LINE_INDEX_CHUNK 0x10000
+
+void LineIndex::build(const Input &input) {
+  if (const char *source = input.data()) {
+    build(source, input.size());
+    return;
+  }
+  std::vector<uint32_t> found{0};
+  char                  buffer[LINE_INDEX_CHUNK + 1];
+  size_t                base = 0;
+  for (;; base += LINE_INDEX_CHUNK) {
+    input.read_chunk(buffer, base, LINE_INDEX_CHUNK);
+    const size_t length = h_strnlen(buffer, LINE_INDEX_CHUNK);
+    find_lines(found, buffer, length, base);
+    if (length < LINE_INDEX_CHUNK) {
+      base += length;
+      break;
+    }
+  }
+  starts = GapList<uint32_t, LinePlace>(std::move(found));
+  end    = base;
+  hint   = 0;
+}
+
+#undef LINE_INDEX_CHUNK
+
+void LineIndex::edit(const size_t offset, const size_t removed,
+  const char *inserted, const size_t length) {
+  // Lines starting right after a removed newline go away
+  const size_t first = partition_index(0, starts.size(), starts.split(),
+    [&](const size_t line) { return start(line) <= offset; });
+  const size_t last  = partition_index(first, starts.size(), first,
+    [&](const size_t line) { return start(line) <= offset + removed; });
+  starts.move(first, end);
+  starts.erase(last - first);
+  end += length - removed;
+
+  std::vector<uint32_t> added;
+  find_lines(added, inserted, length, offset);
+  starts.insert(added.begin(), added.end());
+  hint = first - 1;
+}
+
+void LineIndex::locate(const size_t offset, int *line, int *column) const {
+  const size_t lines = starts.size();
+  size_t       index = hint;
+  // Lookups mostly move forward by a line or two at a time
+  if (start(index) > offset ||
+      (index + 1 < lines && start(index + 1) <= offset)) {
+    if (index + 2 < lines && start(index + 1) <= offset &&
+        start(index + 2) > offset) {
+      index++;
+    } else {
+      index = partition_index(0, lines, index,
+                [&](const size_t at) { return start(at) <= offset; }) -
+              1;
+    }
+  }
+  hint    = index;
+  *line   = static_cast<int>(index) + 1;
+  *column = static_cast<int>(offset - start(index)) + 1;
+}
+
+int LineIndex::line(const size_t offset) const {
+  int line;
+  int column;
+  locate(offset, &line, &column);
+  return line;
+}
@@ -83,6 +83,8 @@ static const char *getData(const Token &t) {
       return "if";
     case Types::IMPORT:
       return "import";
+    case Types::IN:
+      return "in";
     case Types::NEW:
       return "new";
     case Types::RETURN:
@@ -232,7 +234,6 @@ void Logger::fatal(const char *msg) {
 void Logger::print_token(const Token &token) {
   const bool ansi   = supportsAnsi();
   const auto key0   = ansi ? "\x1b[94m" : "";
-  const auto key1   = ansi ? "\x1b[96m" : "";
   const auto text   = ansi ? "\x1b[92m" : "";
   const auto value  = ansi ? "\x1b[93m" : "";
   const auto clear  = ansi ? "\x1b[m" : "";
@@ -241,13 +242,11 @@ void Logger::print_token(const Token &token) {
   printf("%s%sToken%s ", italic, grey, clear);
   printf("<%s%s%s> ", text, getData(token), clear);
   printf("{%s type%s: ", key0, clear);
-  printf("%s%i%s,%s pos%s: {%s line%s: ", value,
-    static_cast<uint8_t>(token.type), clear, key0, clear, key1, clear);
-  printf("%s%i%s,%s start%s: ", value, token.pos.line, clear, key1, clear);
-  printf("%s%i%s,%s end%s: ", value, token.pos.start, clear, key1, clear);
-  printf("%s%i%s,%s absStart%s: ", value, token.pos.end, clear, key1, clear);
-  printf("%s%i%s,%s absEnd%s: ", value, token.pos.absStart, clear, key1, clear);
-  printf("%s%i%s }\n", value, token.pos.absEnd, clear);
+  printf("%s%i%s,%s offset%s: ", value, static_cast<uint8_t>(token.type),
+    clear, key0, clear);
+  printf("%s%u%s,%s length%s: ", value, token.offset, clear, key0, clear);
+  printf("%s%u%s,%s flags%s: ", value, token.length, clear, key0, clear);
+  printf("%s%i%s }\n", value, token.flags, clear);
 }
 
 static void print_bytes(
@@ -264,8 +263,18 @@ static void print_bytes(
 void Logger::disassemble(const Chunk &chunk, const char *name) {
   printf("=== %s ===\n", name);
 
+  int last_line = 0;
   for (int offset = 0; offset < chunk.pos;) {
-    printf(" %04x: ", offset);
+    int line   = 0;
+    int column = 0;
+    if (!chunk.lines.find(offset, &line, &column)) {
+      printf(" %04x:          ", offset);
+    } else if (line == last_line) {
+      printf(" %04x:    | %-3d ", offset, column);
+    } else {
+      printf(" %04x: %4d:%-3d ", offset, line, column);
+    }
+    last_line = line;
 
     switch (static_cast<OpCode>(chunk.code[offset])) {
       case OpCodes::RETURN:
@@ -295,6 +304,36 @@ void Logger::disassemble(const Chunk &chunk, const char *name) {
       case OpCodes::B_NOT:
         print_bytes(1, chunk, &offset, "B_NOT");
         break;
+      case OpCodes::CMP_EQ:
+        print_bytes(1, chunk, &offset, "EQ");
+        break;
+      case OpCodes::CMP_NEQ:
+        print_bytes(1, chunk, &offset, "NEQ");
+        break;
+      case OpCodes::CMP_LT:
+        print_bytes(1, chunk, &offset, "LT");
+        break;
+      case OpCodes::CMP_LEQ:
+        print_bytes(1, chunk, &offset, "LEQ");
+        break;
+      case OpCodes::CMP_GT:
+        print_bytes(1, chunk, &offset, "GT");
+        break;
+      case OpCodes::CMP_GEQ:
+        print_bytes(1, chunk, &offset, "GEQ");
+        break;
+      case OpCodes::I32_AND:
+        print_bytes(1, chunk, &offset, "I32 AND");
+        break;
+      case OpCodes::I32_OR:
+        print_bytes(1, chunk, &offset, "I32 OR");
+        break;
+      case OpCodes::I32_XOR:
+        print_bytes(1, chunk, &offset, "I32 XOR");
+        break;
+      case OpCodes::I32_NOT:
+        print_bytes(1, chunk, &offset, "I32 NOT");
+        break;
       case OpCodes::MOVE:
         print_bytes(10, chunk, &offset, "MOVE");
         break;
@@ -304,14 +343,38 @@ void Logger::disassemble(const Chunk &chunk, const char *name) {
       case OpCodes::STORE:
         print_bytes(2, chunk, &offset, "STORE");
         break;
+      case OpCodes::POP:
+        print_bytes(1, chunk, &offset, "POP");
+        break;
       case OpCodes::RANGE_EXCL:
       case OpCodes::RANGE_L_IN:
       case OpCodes::RANGE_R_IN:
       case OpCodes::RANGE_INCL:
         print_bytes(1, chunk, &offset, "RANGE");
         break;
+      case OpCodes::CALL:
+        print_bytes(5, chunk, &offset, "CALL");
+        break;
+      case OpCodes::CALL_EXT:
+        print_bytes(5, chunk, &offset, "CALL EXT");
+        break;
+      case OpCodes::TAILCALL:
+        print_bytes(5, chunk, &offset, "TAILCALL");
+        break;
+      case OpCodes::JUMP:
+        print_bytes(3, chunk, &offset, "JUMP");
+        break;
+      case OpCodes::JUMP_FALSE:
+        print_bytes(3, chunk, &offset, "JUMP FALSE");
+        break;
+      case OpCodes::JUMP_SHORT:
+        print_bytes(2, chunk, &offset, "JUMP SHORT");
+        break;
+      case OpCodes::JUMP_FALSE_SHORT:
+        print_bytes(2, chunk, &offset, "JUMP FALSE SHORT");
+        break;
       case OpCodes::FX_ENTRY:
-        print_bytes(1, chunk, &offset, "FX ENTRY");
+        print_bytes(3, chunk, &offset, "FX ENTRY");
         break;
       case OpCodes::FX_EXIT:
         print_bytes(1, chunk, &offset, "FX EXIT");
@@ -1,13 +1,20 @@
 #include "arguments.h"
+#include "build.h"
+#include "bundle.h"
 #include "file.h"
 #include "lexer.h"
+#include "module.h"
 #include "parser.h"
+#include "transpile.h"
 #include "vm.h"
 
+#include <csignal>
+#include <cstdlib>
 #include <cstring>
+#include <map>
+#include <thread>
 
 #define MAX_EXT_LENGTH      0x10
-#define MAX_DIR_LENGTH      0x100
 #define MAX_FILENAME_LENGTH 0x100
 
 static void init_arguments(
@@ -16,6 +23,13 @@ static void init_arguments(
   parser->add("lang", 'l');
   parser->add("out", 'o');
   parser->add("disassemble", 'd', false);
+  parser->add("bundle", 'b');
+  parser->add("module", 'm');
+  parser->add("optimize", 'O');
+  parser->add("jobs", 'j');
+  parser->add("inline-report", 'r', false);
+  parser->add("emit", 'e');
+  parser->add("profile", 'p', false);
   //! deprecated options
   parser->add("compile", 'c', false);
   parser->add("interpret", 'i', false);
@@ -23,23 +37,103 @@ static void init_arguments(
   parser->parse(argc, argv);
 }
 
-// todo remove temp function
-void build_path(const File &file, char *path) {
-  char dir[MAX_DIR_LENGTH];
-  char name[MAX_FILENAME_LENGTH];
+// -O0 to -O2, optimizations are off unless asked for
+static int optimization_level(ArgumentParser &argument_parser) {
+  const char *level = argument_parser.get("optimize");
+  if (!level)
+    return 0;
+  if (level[0] < '0' || level[0] > '2' || level[1] != '\0')
+    Logger::fatal("Optimization level must be 0, 1 or 2");
+  return level[0] - '0';
+}
+
+// `--emit=c` writes the C of a module next to it, `--emit=native` compiles
+// that C into an executable. `--out` names the file written instead.
+static void emit(const char *target, Module &module, ModuleCache &modules,
+  const char *out) {
+  const bool native = strcmp(target, "native") == 0;
+  if (!native && strcmp(target, "c") != 0)
+    Logger::fatal("Expected --emit=c or --emit=native");
+
+  const std::string base   = module.dir + "/" + module.name;
+  const std::string path   = out ? out : native ? base : base + ".c";
+  const std::string source = native ? path + ".c" : path;
+  const std::string code   = transpile(module, modules);
+  {
+    File file(source.c_str(), FILE_MODE_WRITE);
+    if (file.write(code.data(), code.size()) != FILE_STATUS_OK)
+      Logger::fatal("Failed to write C");
+  }
+  if (native) {
+    compile_c(source.c_str(), path.c_str());
+    remove(source.c_str());
+  }
+}
+
+// Set by Ctrl-C while a program is profiled, it stops at the next iteration
+// of a loop
+static volatile sig_atomic_t interrupted = 0;
+
+static void interrupt(int) {
+  // Code that does not loop ends by itself, unless it is stuck elsewhere
+  if (interrupted) {
+    signal(SIGINT, SIG_DFL);
+    raise(SIGINT);
+  }
+  interrupted = 1;
+}
+
+// Jumps back of each loop, by the code and position of the jump
+typedef std::map<std::pair<const Chunk *, int>, uint64_t> LoopCounts;
 
-  file.get_dir(dir);   // No allocations in get_dir
-  file.get_name(name); // No allocations in get_name
+static void report(const LoopCounts &counts) {
+  for (const auto &[loop, jumps] : counts) {
+    const auto times = static_cast<unsigned long long>(jumps);
+    int        line;
+    int        column;
+    char       message[128];
+    if (loop.first->lines.find(loop.second, &line, &column))
+      snprintf(message, sizeof(message), "%d:%d: loop jumped back %llu times",
+        line, column, times);
+    else
+      snprintf(message, sizeof(message), "%04x: loop jumped back %llu times",
+        loop.second, times);
+    Logger::info(message);
+  }
+}
+
+static bool count_loop(void *context, const Chunk &chunk, const int ip) {
+  auto &counts = *static_cast<LoopCounts *>(context);
+  counts[{&chunk, ip}]++;
+  // What ran so far is reported before the program stops
+  if (interrupted)
+    report(counts);
+  return !interrupted;
+}
 
-  snprintf(path, MAX_DIR_LENGTH + MAX_FILENAME_LENGTH, "%s/%s.hbc", dir, name);
+// `--profile` counts how often each loop goes round, Ctrl-C stops the program
+// at a loop with the counts so far
+template <typename... Code> static void run(const bool profile, Code &...code) {
+  VM vm;
+  if (!profile) {
+    vm.interpret(code...);
+    return;
+  }
+  LoopCounts counts;
+  vm.on_loop(count_loop, &counts);
+  signal(SIGINT, interrupt);
+  vm.interpret(code...);
+  signal(SIGINT, SIG_DFL);
+  report(counts);
 }
 
-static void repl() {
+static void repl(const int optimization) {
   Chunk  chunk;
   VM     vm;
   Input  input("");
   Lexer  lexer(input);
   Parser parser(lexer, chunk);
+  parser.optimization = optimization;
 
   for (;;) {
     char line[0x400];
@@ -63,15 +157,33 @@ int main(const int argc, char *argv[]) {
   ArgumentParser argument_parser;
 
   init_arguments(&argument_parser, argc, argv);
+  const int optimization = optimization_level(argument_parser);
 
   if (!argument_parser.positional.size()) {
-    repl();
+    repl(optimization);
   }
 
   for (const auto &arg : argument_parser.args) {
     printf("- \"%s\" (-%c): \"%s\"\n", arg.long_name, arg.short_name, arg.value);
   }
 
+  // `hadron build <dir>` compiles a whole tree, one worker per core
+  if (!argument_parser.positional.empty() &&
+      strcmp(argument_parser.positional[0], "build") == 0) {
+    if (argument_parser.positional.size() != 2) {
+      Logger::fatal("Expected one directory to build");
+    }
+    const char *jobs    = argument_parser.get("jobs");
+    const auto  threads = jobs ? static_cast<unsigned>(atoi(jobs))
+                               : std::thread::hardware_concurrency();
+    build(argument_parser.positional[1], optimization, threads);
+    return 0;
+  }
+
+  // Sources are packed into one bundle instead of one .hbc each
+  const char  *bundle_path = argument_parser.get("bundle");
+  BundleWriter bundle_writer;
+
   for (const auto filename : argument_parser.positional) {
     File  file(filename, FILE_MODE_READ);
     Chunk chunk;
@@ -79,55 +191,72 @@ int main(const int argc, char *argv[]) {
     char ext[MAX_EXT_LENGTH];
     file.get_ext(ext);
 
-    if (strncmp(ext, "hbc", 3) == 0) {
-      FileHeader header;
-      if (file.read_header(&header) != FILE_STATUS_OK) {
-        Logger::fatal("Failed to read header");
+    if (strncmp(ext, "hbb", 3) == 0) {
+      const Bundle bundle(file);
+      // Only the selected module is materialized, the rest stay on disk
+      const char        *module = argument_parser.get("module");
+      const BundleEntry *entry =
+        module ? bundle.find(module, h_strlen(module)) : bundle.entry();
+      if (!entry) {
+        Logger::fatal("Module not found in bundle");
       }
-      char name[MAX_FILENAME_LENGTH];
-      if (file.read_name(name, header.name)) {
-        Logger::fatal("Failed to read name");
+      if (!bundle.load(entry, chunk)) {
+        Logger::fatal("Failed to load module");
       }
-
-      char c;
-      while (file.read_byte(&c) != FILE_READ_DONE) {
-        chunk.write(c);
+      char name[MAX_FILENAME_LENGTH];
+      if (!bundle.get_name(entry, name, sizeof(name))) {
+        Logger::fatal("Bundle index is corrupted");
       }
       if (argument_parser.is_set("disassemble")) {
         Logger::disassemble(chunk, name);
         continue;
       }
 
-      VM().interpret(chunk);
+      run(argument_parser.is_set("profile"), chunk);
       continue;
     }
 
-    Input input(file);
-    Lexer lexer(input);
-
-    Parser parser(lexer, chunk);
-
-    parser.parse();
-
-    char path[MAX_DIR_LENGTH + MAX_FILENAME_LENGTH];
-    build_path(file, path);
-
-    File out(path, FILE_MODE_WRITE);
+    if (strncmp(ext, "hbc", 3) == 0) {
+      // Modules it imports are found next to it, once code calls into them
+      ModuleCache modules;
+      modules.optimization = optimization;
+      Module *module       = modules.open(filename);
+      if (argument_parser.is_set("disassemble")) {
+        Logger::disassemble(module->chunk, module->name.c_str());
+        continue;
+      }
+      if (const char *target = argument_parser.get("emit")) {
+        emit(target, *module, modules, argument_parser.get("out"));
+        continue;
+      }
 
-    if (out.write_header() != FILE_STATUS_OK) {
-      Logger::fatal("Failed to write header");
+      run(argument_parser.is_set("profile"), *module, modules);
+      continue;
     }
 
-    char name[MAX_FILENAME_LENGTH];
-    file.get_name(name);
+    Module module;
+    compile_module(file, module, optimization,
+      std::thread::hardware_concurrency(),
+      argument_parser.is_set("inline-report"));
 
-    out << name;
-
-    for (int i = 0; i < chunk.pos; i++) {
-      out << chunk.code[i];
+    if (bundle_path) {
+      bundle_writer.add(module.name.c_str(), module.chunk);
+      continue;
     }
+    if (const char *target = argument_parser.get("emit")) {
+      ModuleCache modules;
+      modules.optimization = optimization;
+      emit(target, module, modules, argument_parser.get("out"));
+      continue;
+    }
+
+    write_module(file, module);
     // Logger::disassemble(chunk, name);
   }
 
+  if (bundle_path && bundle_writer.write(bundle_path) != FILE_STATUS_OK) {
+    Logger::fatal("Failed to write bundle");
+  }
+
   return 0;
 }
@@ -0,0 +1,285 @@
+#include "module.h"
+#include "parser.h"
+#include "tokenize.h"
+
+#include <sys/stat.h>
+#include <thread>
+
+#define MAX_DIR_LENGTH      0x100
+#define MAX_FILENAME_LENGTH 0x100
+
+static void parse_module(Parser &parser, Module &module,
+  const int optimization, const bool report_inlining) {
+  parser.optimization    = optimization;
+  parser.report_inlining = report_inlining;
+  parser.parse();
+
+  module.exports = std::move(parser.exports);
+  module.imports = std::move(parser.imports);
+  module.links.resize(module.imports.size());
+}
+
+void compile_module(File &file, Module &module, const int optimization,
+  const unsigned threads, const bool report_inlining) {
+  char dir[MAX_DIR_LENGTH];
+  char name[MAX_FILENAME_LENGTH];
+  file.get_dir(dir);
+  file.get_name(name);
+  module.dir  = dir;
+  module.name = name;
+
+  Input input(file, InputType::MAPPED);
+  Lexer lexer(input);
+
+  // One core lexes faster on its own, splitting only pays with more
+  if (threads > 1 && input.data() && input.size() >= LEX_PARALLEL_SOURCE) {
+    const std::vector<Token> tokens =
+      tokenize(input.data(), input.size(), threads);
+    Parser parser(lexer, module.chunk, tokens.data(), tokens.size());
+    parse_module(parser, module, optimization, report_inlining);
+    return;
+  }
+  Parser parser(lexer, module.chunk);
+  parse_module(parser, module, optimization, report_inlining);
+}
+
+// Names are at most 255 bytes, each is preceded by its length
+static void put_name(std::vector<uint8_t> &data, const std::string &name) {
+  if (name.size() > UINT8_MAX)
+    Logger::fatal("Name too long for a module table");
+  data.push_back(static_cast<uint8_t>(name.size()));
+  data.insert(data.end(), name.begin(), name.end());
+}
+
+static bool get_name(const std::vector<uint8_t> &data, size_t *at,
+  std::string *name) {
+  if (*at >= data.size() || data[*at] > data.size() - *at - 1)
+    return false;
+  const size_t length = data[(*at)++];
+  name->assign(reinterpret_cast<const char *>(data.data()) + *at, length);
+  *at += length;
+  return true;
+}
+
+//   exports: (u16 location, u8 arity, name)...
+//   imports: (module name, function name)...
+static bool read_exports(const std::vector<uint8_t> &data, Module &module) {
+  for (size_t at = 0; at < data.size();) {
+    ModuleExport entry;
+    if (data.size() - at < 3)
+      return false;
+    entry.location = data[at] | data[at + 1] << 8;
+    entry.arity    = data[at + 2];
+    at += 3;
+    if (!get_name(data, &at, &entry.name))
+      return false;
+    module.exports.push_back(std::move(entry));
+  }
+  return true;
+}
+
+static bool read_imports(const std::vector<uint8_t> &data, Module &module) {
+  for (size_t at = 0; at < data.size();) {
+    ModuleImport entry;
+    if (!get_name(data, &at, &entry.module) ||
+        !get_name(data, &at, &entry.name))
+      return false;
+    module.imports.push_back(std::move(entry));
+  }
+  return true;
+}
+
+void read_module(File &file, Module &module) {
+  FileHeader header;
+  if (file.read_header(&header) != FILE_STATUS_OK) {
+    Logger::fatal("Failed to read header");
+  }
+  char name[MAX_FILENAME_LENGTH];
+  if (file.read_name(name, header.name)) {
+    Logger::fatal("Failed to read name");
+  }
+  char dir[MAX_DIR_LENGTH];
+  file.get_dir(dir);
+  module.dir  = dir;
+  module.name = name;
+
+  Chunk &chunk = module.chunk;
+  if (header.minor < 2) {
+    // 0.1 files end with the bare code
+    char c;
+    while (file.read_byte(&c) != FILE_READ_DONE) {
+      chunk.write(c);
+    }
+    return;
+  }
+
+  FileSection          section;
+  FileResult           res;
+  std::vector<uint8_t> data;
+  while ((res = file.read_section(&section)) == FILE_STATUS_OK) {
+    switch (section.type) {
+      case FILE_SECTION_CODE:
+        if (section.size > MAX_INSTRUCTIONS ||
+            file.read_data(chunk.code, section.size) != FILE_STATUS_OK) {
+          Logger::fatal("Failed to read code");
+        }
+        chunk.pos = static_cast<int>(section.size);
+        break;
+      case FILE_SECTION_LINES: {
+        uint8_t table[MAX_LINE_TABLE];
+        if (section.size > MAX_LINE_TABLE ||
+            file.read_data(table, section.size) != FILE_STATUS_OK ||
+            !chunk.lines.load(table, section.size)) {
+          Logger::fatal("Failed to read line table");
+        }
+        break;
+      }
+      case FILE_SECTION_EXPORTS:
+        data.resize(section.size);
+        if (file.read_data(data.data(), section.size) != FILE_STATUS_OK ||
+            !read_exports(data, module)) {
+          Logger::fatal("Failed to read exports");
+        }
+        break;
+      case FILE_SECTION_IMPORTS:
+        data.resize(section.size);
+        if (file.read_data(data.data(), section.size) != FILE_STATUS_OK ||
+            !read_imports(data, module)) {
+          Logger::fatal("Failed to read imports");
+        }
+        break;
+      default:
+        if (file.skip(section.size) != FILE_STATUS_OK) {
+          Logger::fatal("Failed to skip section");
+        }
+    }
+  }
+  if (res != FILE_READ_DONE) {
+    Logger::fatal("Failed to read section");
+  }
+  module.links.resize(module.imports.size());
+}
+
+void write_module(const File &file, const Module &module) {
+  char dir[MAX_DIR_LENGTH];
+  char name[MAX_FILENAME_LENGTH];
+  file.get_dir(dir);
+  file.get_name(name);
+
+  // Tables are built first, a name they cannot hold leaves no file behind
+  const Chunk         &chunk = module.chunk;
+  std::vector<uint8_t> exports;
+  for (const auto &entry : module.exports) {
+    exports.push_back(static_cast<uint8_t>(entry.location));
+    exports.push_back(static_cast<uint8_t>(entry.location >> 8));
+    exports.push_back(entry.arity);
+    put_name(exports, entry.name);
+  }
+  std::vector<uint8_t> imports;
+  for (const auto &entry : module.imports) {
+    put_name(imports, entry.module);
+    put_name(imports, entry.name);
+  }
+
+  const std::string path = std::string(dir) + "/" + name + ".hbc";
+  File              out(path.c_str(), FILE_MODE_WRITE);
+  FileHeader        header;
+  out.fill_header(&header);
+  header.flags |= FILE_FLAG_LINES;
+
+  FileSection code  = {FILE_SECTION_CODE, {}, static_cast<uint32_t>(chunk.pos)};
+  FileSection lines = {
+    FILE_SECTION_LINES, {}, static_cast<uint32_t>(chunk.lines.size)};
+  FileSection exported = {
+    FILE_SECTION_EXPORTS, {}, static_cast<uint32_t>(exports.size())};
+  FileSection imported = {
+    FILE_SECTION_IMPORTS, {}, static_cast<uint32_t>(imports.size())};
+
+  // Everything reaches the file in a single writev, modules without exports
+  // or imports leave their sections out
+  iovec sections[10] = {
+    {&header, sizeof(FileHeader)},
+    {name, header.name},
+    {&code, sizeof(FileSection)},
+    {const_cast<uint8_t *>(chunk.code), code.size},
+    {&lines, sizeof(FileSection)},
+    {const_cast<uint8_t *>(chunk.lines.data), lines.size},
+  };
+  int count = 6;
+  if (!exports.empty()) {
+    sections[count++] = {&exported, sizeof(FileSection)};
+    sections[count++] = {exports.data(), exports.size()};
+  }
+  if (!imports.empty()) {
+    sections[count++] = {&imported, sizeof(FileSection)};
+    sections[count++] = {imports.data(), imports.size()};
+  }
+  if (out.write_vectored(sections, count) != FILE_STATUS_OK) {
+    Logger::fatal("Failed to write bytecode");
+  }
+}
+
+Module *ModuleCache::load(const std::string &dir, const std::string &name) {
+  const std::string path = dir + "/" + name;
+  if (const auto found = modules.find(path); found != modules.end())
+    return found->second.get();
+
+  const std::string source   = path + ".hdn";
+  const std::string bytecode = path + ".hbc";
+  struct stat       source_info {};
+  struct stat       bytecode_info {};
+  const bool        compiled = stat(bytecode.c_str(), &bytecode_info) == 0;
+  const bool        written  = stat(source.c_str(), &source_info) == 0;
+  if (!compiled && !written)
+    return nullptr;
+
+  // A source changed within the second its .hbc was written is compiled again
+  auto module = std::make_unique<Module>();
+  if (written &&
+      (!compiled || source_info.st_mtime >= bytecode_info.st_mtime)) {
+    File file(source.c_str(), FILE_MODE_READ);
+    compile_module(
+      file, *module, optimization, std::thread::hardware_concurrency());
+    write_module(file, *module);
+  } else {
+    File file(bytecode.c_str(), FILE_MODE_READ);
+    read_module(file, *module);
+  }
+  return (modules[path] = std::move(module)).get();
+}
+
+Module *ModuleCache::open(const char *path) {
+  File file(path, FILE_MODE_READ);
+  auto module = std::make_unique<Module>();
+  read_module(file, *module);
+
+  char name[MAX_FILENAME_LENGTH];
+  file.get_name(name);
+  Module *opened = module.get();
+  modules[module->dir + "/" + name] = std::move(module);
+  return opened;
+}
+
+const ModuleLink &ModuleCache::link(Module &module, const uint32_t slot) {
+  if (slot >= module.links.size()) {
+    Logger::fatal("Unknown import");
+  }
+  ModuleLink &link = module.links[slot];
+  if (link.module)
+    return link;
+
+  const ModuleImport &import = module.imports[slot];
+  Module             *target = load(module.dir, import.module);
+  if (!target) {
+    Logger::fatal("Module not found");
+  }
+  for (uint32_t i = 0; i < target->exports.size(); i++) {
+    if (target->exports[i].name == import.name) {
+      link.module = target;
+      link.slot   = i;
+      return link;
+    }
+  }
+  Logger::fatal("Function not exported by module");
+  return link; // never reached
+}
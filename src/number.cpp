@@ -0,0 +1,260 @@
+#include "number.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <string>
+
+#define MAX_DECIMAL_DIGITS 19      // always fit in 64 bits
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+#define MAX_EXPONENT       0x10000 // far beyond the range of a double
+#define MAX_INLINE_LITERAL 0x80
+
+static const double exact_powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+  1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+  1e21, 1e22};
+
+#if LDBL_MANT_DIG == 64
+// Powers of ten up to 5^27 fit in the 64-bit significand of x87 long doubles
+static const long double extended_powers[] = {1e0L, 1e1L, 1e2L, 1e3L, 1e4L,
+  1e5L, 1e6L, 1e7L, 1e8L, 1e9L, 1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L,
+  1e16L, 1e17L, 1e18L, 1e19L, 1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L,
+  1e27L};
+
+// Any 19 digit mantissa is exact as well, so the product is rounded once to
+// 64 bits. Rounding that again to 53 bits is only ambiguous when the 11
+// dropped bits sit exactly on the halfway point.
+static bool extended_value(
+  const uint64_t value, const int exponent, double *result) {
+  if (exponent > 27 || exponent < -27)
+    return false;
+  const auto        mantissa = static_cast<long double>(value);
+  const long double product  = exponent >= 0
+                                 ? mantissa * extended_powers[exponent]
+                                 : mantissa / extended_powers[-exponent];
+  int               binary_exponent;
+  const auto        significand = static_cast<uint64_t>(
+    ldexpl(frexpl(product, &binary_exponent), 64));
+  if ((significand & 0x7FF) == 0x400)
+    return false;
+  *result = static_cast<double>(product);
+  return true;
+}
+#endif
+
+static int digit_value(const char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+static bool is_separator(const char c) { return c == '_' || c == '\''; }
+
+// Characters that would silently change the meaning of a literal if it were
+// allowed to end right before them
+static bool continues_literal(const char c) {
+  return digit_value(c) >= 0 || is_separator(c) || c == 'x' || c == 'X' ||
+         c == 'o' || c == 'O' || c == 'b' || c == 'B' || c == 'p' || c == 'P';
+}
+
+typedef struct Mantissa {
+  uint64_t value{0};
+  int      exponent{0}; // base 10 for decimals, base 2 otherwise
+  int      digits{0};   // significant decimal digits in `value`
+  bool     sticky{false}; // non-zero digits were dropped
+} Mantissa;
+
+static void add_decimal(Mantissa &m, const int digit, const bool fraction) {
+  if (m.digits < MAX_DECIMAL_DIGITS) {
+    m.value = m.value * 10 + digit;
+    m.digits += m.value != 0;
+    m.exponent -= fraction;
+    return;
+  }
+  m.exponent += !fraction;
+  m.sticky |= digit != 0;
+}
+
+static void add_binary(
+  Mantissa &m, const int digit, const int bits, const bool fraction) {
+  if (!(m.value >> (64 - bits))) {
+    m.value = m.value << bits | digit;
+    m.exponent -= fraction ? bits : 0;
+    return;
+  }
+  m.exponent += fraction ? 0 : bits;
+  m.sticky |= digit != 0;
+}
+
+// Clinger's fast path: the mantissa and the power of ten are both exact
+// doubles, so one multiplication or division rounds correctly. Longer
+// mantissas try extended precision, anything else goes through strtod, which
+// is correctly rounded as well.
+static double decimal_value(
+  const Mantissa &m, const char *s, const size_t length) {
+  if (!m.value)
+    return 0;
+  if (!m.sticky && m.value <= MAX_EXACT_MANTISSA) {
+    uint64_t value    = m.value;
+    int      exponent = m.exponent;
+    // Move surplus powers of ten into the mantissa while it stays exact
+    while (exponent > 22 && value * 10 <= MAX_EXACT_MANTISSA) {
+      value *= 10;
+      exponent--;
+    }
+    if (exponent >= 0 && exponent <= 22)
+      return static_cast<double>(value) * exact_powers[exponent];
+    if (exponent < 0 && exponent >= -22)
+      return static_cast<double>(value) / exact_powers[-exponent];
+  }
+#if LDBL_MANT_DIG == 64
+  double result;
+  if (!m.sticky && extended_value(m.value, m.exponent, &result))
+    return result;
+#endif
+  // strtod needs the literal without separators and terminated
+  char        inline_text[MAX_INLINE_LITERAL];
+  std::string long_text;
+  char       *text = inline_text;
+  if (length >= MAX_INLINE_LITERAL) {
+    long_text.resize(length + 1);
+    text = &long_text[0];
+  }
+  size_t text_length = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (!is_separator(s[i]))
+      text[text_length++] = s[i];
+  }
+  text[text_length] = '\0';
+  return strtod(text, nullptr);
+}
+
+// Conversion of the 64-bit mantissa rounds once, dropped digits only matter
+// for ties and are folded into the lowest bit
+static double binary_value(const Mantissa &m) {
+  const uint64_t value = m.sticky ? m.value | 1 : m.value;
+  return ldexp(static_cast<double>(value), m.exponent);
+}
+
+NumberLiteral scan_number(const char *s, const size_t n) {
+  const auto at = [&](const size_t i) { return i < n ? s[i] : '\0'; };
+
+  NumberLiteral result{Types::ERROR, false, 0, 0};
+  Mantissa      m;
+  int           bits = 0; // bits per digit, 0 for decimals
+  size_t        i    = 0;
+
+  if (at(0) == '0') {
+    switch (at(1)) {
+      case 'x':
+      case 'X':
+        result.type = Types::HEX, bits = 4;
+        break;
+      case 'b':
+      case 'B':
+        result.type = Types::BINARY, bits = 1;
+        break;
+      case 'o':
+      case 'O':
+        result.type = Types::OCTAL, bits = 3;
+        break;
+      default:
+        result.type = Types::DEC;
+    }
+    i = bits ? 2 : 0;
+  } else {
+    result.type = Types::DEC;
+  }
+  const int base = bits ? 1 << bits : 10;
+
+  // Reads one run of digits, separators are only allowed between digits
+  const auto digits = [&](const bool fraction) {
+    int count = 0;
+    for (;; i++) {
+      const int digit = digit_value(at(i));
+      if (digit >= 0 && digit < base) {
+        if (bits)
+          add_binary(m, digit, bits, fraction);
+        else
+          add_decimal(m, digit, fraction);
+        count++;
+        continue;
+      }
+      const int next = digit_value(at(i + 1));
+      if (!count || !is_separator(at(i)) || next < 0 || next >= base)
+        return count;
+    }
+  };
+
+  const auto fail = [&]() {
+    result.type   = Types::ERROR;
+    result.length = i;
+    return result;
+  };
+
+  int  count    = digits(false);
+  bool fraction = false;
+  if (at(i) == '.' && at(i + 1) != '.') {
+    // Binary and octal literals are integers only
+    if (result.type == Types::BINARY || result.type == Types::OCTAL)
+      return fail();
+    i++;
+    fraction = true;
+    count += digits(true);
+  }
+  if (!count)
+    return fail();
+
+  bool had_exp = false;
+  if ((bits == 0 && (at(i) == 'e' || at(i) == 'E')) ||
+      (bits == 4 && (at(i) == 'p' || at(i) == 'P'))) {
+    had_exp        = true;
+    const bool neg = at(i + 1) == '-';
+    i += 1 + (at(i + 1) == '-' || at(i + 1) == '+');
+    if (digit_value(at(i)) < 0 || digit_value(at(i)) > 9)
+      return fail();
+    int exponent = 0;
+    for (; (at(i) >= '0' && at(i) <= '9') ||
+           (is_separator(at(i)) && at(i + 1) >= '0' && at(i + 1) <= '9');
+         i++) {
+      if (!is_separator(at(i)) && exponent < MAX_EXPONENT)
+        exponent = exponent * 10 + (at(i) - '0');
+    }
+    m.exponent += neg ? -exponent : exponent;
+  }
+  // Hexadecimal fractions need a binary exponent, as in C
+  if (result.type == Types::HEX && fraction && !had_exp)
+    return fail();
+  if (continues_literal(at(i)) || (at(i) == '.' && at(i + 1) != '.'))
+    return fail();
+
+  result.length = i;
+  result.dotted = fraction || result.type == Types::BINARY ||
+                  result.type == Types::OCTAL;
+
+  if (bits) {
+    result.value = binary_value(m);
+    return result;
+  }
+  // Zero-prefixed integers without the digits 8 and 9 are octal
+  if (at(0) == '0' && i > 1 && !fraction && !had_exp) {
+    Mantissa octal;
+    size_t   k = 0;
+    while (k < i && (is_separator(s[k]) || (s[k] >= '0' && s[k] <= '7'))) {
+      if (!is_separator(s[k]))
+        add_binary(octal, s[k] - '0', 3, false);
+      k++;
+    }
+    if (k == i) {
+      result.type  = Types::OCTAL;
+      result.value = binary_value(octal);
+      return result;
+    }
+  }
+  result.value = decimal_value(m, s, i);
+  return result;
+}
@@ -1,24 +1,460 @@
 #include "parser.h"
 #include "types.h"
 
-Parser::Parser(Lexer &lexer, Chunk &chunk) : lexer(lexer), chunk(chunk) {}
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+Parser::Parser(Lexer &lexer, Chunk &chunk)
+  : lexer(lexer), chunk(chunk),
+    tokens(lexer, lexer.source_size() >= LEX_THREAD_SOURCE) {}
+
+Parser::Parser(Lexer &lexer, Chunk &chunk, const LineIndex *lines)
+  : lexer(lexer), chunk(chunk), tokens(lexer, false), lines(lines) {}
+
+Parser::Parser(Lexer &lexer, Chunk &chunk, const Token *tokens,
+  const size_t length, const LineIndex *lines)
+  : lexer(lexer), chunk(chunk), tokens(lexer, tokens, length), lines(lines) {}
 
 void Parser::advance() {
   prev_token    = current_token;
-  current_token = lexer.advance();
+  current_token = &tokens.next();
+  line_breaks += current_token->flags & TOKEN_NEWLINE;
 }
 
-Token &Parser::consume(const Type type, const char *error) {
-  if (current_token.type == type) {
+const Token &Parser::consume(const Type type, const char *error) {
+  if (current_token->type == type) {
     advance();
-    return prev_token;
+    return *prev_token;
   }
   Logger::fatal(error);
-  return current_token; // never reached
+  return *current_token; // never reached
+}
+
+// Records the source position of the next instruction
+void Parser::mark(const Token &token) { mark(token.offset); }
+
+void Parser::mark(const uint32_t offset) {
+  int line;
+  int column;
+  locate(offset, &line, &column);
+  chunk.lines.add(chunk.pos, line, column);
+}
+
+void Parser::locate(const uint32_t offset, int *line, int *column) {
+  if (!lines) {
+    own_lines.build(lexer.source());
+    lines = &own_lines;
+  }
+  lines->locate(offset, line, column);
+}
+
+// What is known of the value on top of the stack, as it is taken off
+static SymbolType pop_type(Scope &scope) {
+  if (scope.types.empty())
+    return SymbolType::F64;
+  const SymbolType type = scope.types.back();
+  scope.types.pop_back();
+  return type;
+}
+
+// Bitwise operations need integers, on operands known to be integers they
+// become operations that need no checks
+static OpCode specialize(const OpCode op) {
+  switch (op) {
+    case OpCodes::B_AND:
+      return OpCodes::I32_AND;
+    case OpCodes::B_OR:
+      return OpCodes::I32_OR;
+    case OpCodes::B_XOR:
+      return OpCodes::I32_XOR;
+    case OpCodes::B_NOT:
+      return OpCodes::I32_NOT;
+    default:
+      return op;
+  }
+}
+
+// Integers stay integers through arithmetic other than division, logical
+// operations and comparisons give 0 or 1
+static SymbolType result_type(const OpCode op, const bool integers) {
+  switch (op) {
+    case OpCodes::NOT:
+    case OpCodes::L_AND:
+    case OpCodes::L_OR:
+    case OpCodes::CMP_EQ:
+    case OpCodes::CMP_NEQ:
+    case OpCodes::CMP_LT:
+    case OpCodes::CMP_LEQ:
+    case OpCodes::CMP_GT:
+    case OpCodes::CMP_GEQ:
+      return SymbolType::I32;
+    case OpCodes::ADD:
+    case OpCodes::SUB:
+    case OpCodes::MUL:
+    case OpCodes::NEGATE:
+    case OpCodes::I32_AND:
+    case OpCodes::I32_OR:
+    case OpCodes::I32_XOR:
+    case OpCodes::I32_NOT:
+      return integers ? SymbolType::I32 : SymbolType::F64;
+    default:
+      return SymbolType::F64;
+  }
+}
+
+void Parser::emit(OpCode op, const Token &token) {
+  bool integers = true;
+  for (int i = 0; i < ir_arity(op); i++)
+    integers = pop_type(scope) == SymbolType::I32 && integers;
+  if (integers)
+    op = specialize(op);
+  if (ir_defines(op))
+    scope.types.push_back(result_type(op, integers));
+
+  scope.depth += (ir_defines(op) ? 1 : 0) - ir_arity(op);
+  if (optimization) {
+    scope.ir.add(op, token.offset);
+    return;
+  }
+  mark(token);
+  chunk.write(op);
+}
+
+static void write_move(Chunk &chunk, const double number) {
+  chunk.write(OpCodes::MOVE);
+  chunk.write(static_cast<uint8_t>(0)); // register
+  chunk.write(number);
+}
+
+// Calls within the module are relative to the instruction, code stays valid
+// wherever the statement holding it is linked. Calls into other modules name
+// an import slot instead.
+static void write_call(Chunk &chunk, const OpCode op, const int operand,
+  const size_t argc, const uint32_t keep) {
+  chunk.write(op);
+  chunk.write(static_cast<uint16_t>(operand));
+  chunk.write(static_cast<uint8_t>(argc));
+  chunk.write(static_cast<uint8_t>(keep));
+}
+
+// The size of the body is patched in once it is written
+static void write_entry(Chunk &chunk) {
+  chunk.write(OpCodes::FX_ENTRY);
+  chunk.write(static_cast<uint16_t>(0));
+}
+
+static void patch_entry(Chunk &chunk, const int entry) {
+  *reinterpret_cast<uint16_t *>(chunk.code + entry + 1) =
+    static_cast<uint16_t>(chunk.pos - entry - 3);
+}
+
+// Functions are looked up again when calls to them are lowered
+static Symbol *find(Parser &parser, const Slice name) {
+  const Token token{Types::NAME, 0, name.offset, name.length, 0};
+  return parser.symbols.lookup(parser.lexer.view(token), name.length);
+}
+
+// Literals spelled without a fraction or an exponent are integers
+static bool is_integer(Parser &parser, const Token &token, const double value) {
+  if (!std::isfinite(value) || std::trunc(value) != value)
+    return false;
+  const char *text  = parser.lexer.view(token);
+  const char *marks = token.type == Types::HEX ? ".pP" : ".eE";
+  for (uint32_t i = 0; i < token_text(token).length; i++) {
+    if (strchr(marks, text[i]))
+      return false;
+  }
+  return true;
+}
+
+// Offset of the function `name` from a call written at the current position
+static int call_offset(Parser &parser, const Slice name) {
+  const Symbol *callee = find(parser, name);
+  if (callee->location >= 0)
+    return callee->location - parser.chunk.pos;
+  const Token token{Types::NAME, 0, name.offset, name.length, 0};
+  parser.fixups.push_back(
+    {parser.chunk.pos, std::string(parser.lexer.view(token), name.length)});
+  return 0;
+}
+
+static void patch_calls(Parser &parser, const std::string &name,
+  const int location) {
+  auto &fixups = parser.fixups;
+  for (size_t i = 0; i < fixups.size();) {
+    if (fixups[i].name != name) {
+      i++;
+      continue;
+    }
+    *reinterpret_cast<int16_t *>(parser.chunk.code + fixups[i].at + 1) =
+      static_cast<int16_t>(location - fixups[i].at);
+    fixups[i] = std::move(fixups.back());
+    fixups.pop_back();
+  }
+}
+
+// Whether the result of a call ending at `at` is what the function returns.
+// Loads and stores on the way only touch the frame, which goes anyway.
+static bool returns_result(const Chunk &chunk, int at) {
+  int above = 0; // values pushed over the result
+  for (int steps = 0; steps < 0x100 && at < chunk.pos; steps++) {
+    const auto op = static_cast<OpCode>(chunk.code[at]);
+    switch (op) {
+      case OpCodes::FX_EXIT:
+        return !above;
+      case OpCodes::JUMP:
+        at += *reinterpret_cast<const int16_t *>(chunk.code + at + 1);
+        continue;
+      case OpCodes::JUMP_SHORT:
+        at += static_cast<int8_t>(chunk.code[at + 1]);
+        continue;
+      case OpCodes::MOVE:
+      case OpCodes::LOAD:
+        above++;
+        break;
+      case OpCodes::STORE:
+      case OpCodes::POP:
+        if (!above--)
+          return false;
+        break;
+      default:
+        return false;
+    }
+    at += instruction_size(op);
+  }
+  return false;
+}
+
+// Calls in tail position of the body starting at `body` reuse the frame, so
+// that recursion runs in constant space. Bodies of the functions defined in
+// it were done on their own.
+static void mark_tail_calls(Chunk &chunk, const int body) {
+  for (int at = body; at < chunk.pos;) {
+    const auto op = static_cast<OpCode>(chunk.code[at]);
+    if (op == OpCodes::FX_ENTRY)
+      at += *reinterpret_cast<uint16_t *>(chunk.code + at + 1);
+    else if (op == OpCodes::CALL && returns_result(chunk, at + 5))
+      chunk.code[at] = static_cast<uint8_t>(OpCodes::TAILCALL);
+    at += instruction_size(op);
+  }
+}
+
+void Parser::emit(const double number, const Token &token) {
+  scope.types.push_back(
+    is_integer(*this, token, number) ? SymbolType::I32 : SymbolType::F64);
+  scope.depth++;
+  if (optimization) {
+    scope.ir.constant(number, token.offset);
+    return;
+  }
+  mark(token);
+  write_move(chunk, number);
+}
+
+uint32_t Parser::declare(const Token &name, const SymbolType type) {
+  if (!scope.locals.insert(lexer.view(name), token_text(name).length,
+        static_cast<int>(scope.count), type))
+    Logger::fatal("Variable already declared");
+  return reserve();
+}
+
+uint32_t Parser::reserve() {
+  // Slot operands and the slots a call keeps are one byte
+  if (scope.count == UINT8_MAX)
+    Logger::fatal("Too many locals");
+  if (optimization)
+    scope.ir.locals.push_back(IR_NONE);
+  return scope.count++;
+}
+
+void Parser::emit_load(
+  const uint32_t local, const SymbolType type, const Token &token) {
+  scope.types.push_back(type);
+  scope.depth++;
+  if (optimization) {
+    scope.ir.stack.push_back(scope.ir.locals[local]);
+    return;
+  }
+  mark(token);
+  chunk.write(OpCodes::LOAD);
+  chunk.write(static_cast<uint8_t>(local));
+}
+
+void Parser::emit_store(const uint32_t local, const Token &token) {
+  pop_type(scope);
+  scope.depth--;
+  if (optimization) {
+    IrFunction &ir = scope.ir;
+    if (ir.stack.empty() && scope.branched) {
+      // The value was left by the block before, the local takes it from
+      // the VM stack once this block is lowered
+      settle(token);
+      mark(token);
+      chunk.write(OpCodes::STORE);
+      chunk.write(static_cast<uint8_t>(local));
+      return;
+    }
+    if (ir.stack.empty()) {
+      ir.locals[local] = IR_NONE;
+      return;
+    }
+    ir.locals[local] = ir.stack.back();
+    ir.stack.pop_back();
+    return;
+  }
+  mark(token);
+  chunk.write(OpCodes::STORE);
+  chunk.write(static_cast<uint8_t>(local));
+}
+
+// At -O2 a call to a small function is replaced by its body. Functions not
+// known yet are defined further down, or still being parsed, in which case
+// the call is in their own body.
+static bool inline_call(Parser &parser, const Token &name, const uint8_t argc,
+  const Token &token) {
+  const std::string callee(parser.lexer.view(name), token_text(name).length);
+  const auto        found   = parser.inlinees.find(callee);
+  const char       *blocker = found != parser.inlinees.end()
+                                ? found->second.blocker
+                                : find(parser, token_text(name))->location < 0
+                                  ? "it is defined further down"
+                                  : "it is recursive";
+  if (!blocker && parser.scope.ir.stack.size() < argc)
+    blocker = "its arguments were left by an earlier statement";
+
+  if (parser.report_inlining) {
+    int  line;
+    int  column;
+    char message[0x100];
+    parser.locate(token.offset, &line, &column);
+    if (blocker)
+      snprintf(message, sizeof(message), "%d:%d: kept the call to %s, %s",
+        line, column, callee.c_str(), blocker);
+    else
+      snprintf(message, sizeof(message), "%d:%d: inlined %s", line, column,
+        callee.c_str());
+    Logger::info(message);
+  }
+  if (blocker)
+    return false;
+  ir_inline(parser.scope.ir, found->second.body, argc, token.offset);
+  return true;
+}
+
+void Parser::emit_call(
+  const Token &name, const uint8_t argc, const Token &token) {
+  // Nothing is known of what functions return
+  for (int i = 0; i < argc; i++)
+    pop_type(scope);
+  scope.types.push_back(SymbolType::F64);
+  scope.depth += 1 - argc;
+  if (optimization >= 2 && inline_call(*this, name, argc, token))
+    return;
+  if (optimization) {
+    Any callee;
+    callee.slice = token_text(name);
+    scope.ir.call(OpCodes::CALL, callee, argc, token.offset);
+    return;
+  }
+  // The frame of the callee starts above the locals declared so far
+  mark(token);
+  const int offset = call_offset(*this, token_text(name));
+  write_call(chunk, OpCodes::CALL, offset, argc, scope.count);
+}
+
+void Parser::emit_call(
+  const uint32_t import, const uint8_t argc, const Token &token) {
+  for (int i = 0; i < argc; i++)
+    pop_type(scope);
+  scope.types.push_back(SymbolType::F64);
+  scope.depth += 1 - argc;
+  if (optimization) {
+    Any callee;
+    callee.u32 = import;
+    scope.ir.call(OpCodes::CALL_EXT, callee, argc, token.offset);
+    return;
+  }
+  mark(token);
+  write_call(chunk, OpCodes::CALL_EXT, static_cast<int>(import), argc,
+    scope.count);
+}
+
+int Parser::emit_jump(const OpCode op, const Token &token) {
+  settle(token);
+  if (op == OpCodes::JUMP_FALSE) {
+    pop_type(scope);
+    scope.depth--;
+  }
+  mark(token);
+  const int jump = chunk.pos;
+  chunk.write(op);
+  chunk.write(static_cast<int16_t>(0));
+  return jump;
+}
+
+void Parser::patch_jump(const int jump, const int target) {
+  if (target - jump < INT16_MIN || target - jump > INT16_MAX)
+    Logger::fatal("Jump too long");
+  *reinterpret_cast<int16_t *>(chunk.code + jump + 1) =
+    static_cast<int16_t>(target - jump);
+}
+
+void Parser::emit_loop(const OpCode op, const int target, const Token &token) {
+  settle(token);
+  if (op == OpCodes::JUMP_FALSE) {
+    pop_type(scope);
+    scope.depth--;
+  }
+  mark(token);
+  const int offset = target - chunk.pos;
+  if (offset >= INT8_MIN) {
+    chunk.write(op == OpCodes::JUMP ? OpCodes::JUMP_SHORT
+                                    : OpCodes::JUMP_FALSE_SHORT);
+    chunk.write(static_cast<int8_t>(offset));
+    return;
+  }
+  if (offset < INT16_MIN)
+    Logger::fatal("Jump too long");
+  chunk.write(op);
+  chunk.write(static_cast<int16_t>(offset));
+}
+
+int Parser::label(const Token &token) {
+  settle(token);
+  return chunk.pos;
+}
+
+// Lowers the block so far, the next one starts with every local in its slot
+void Parser::settle(const Token &token) {
+  if (!optimization)
+    return;
+  IrFunction &ir = scope.ir;
+  scope.branched = true;
+  ir.close(token.offset);
+  lower(ir);
+  const auto locals = static_cast<uint32_t>(ir.locals.size());
+  ir.clear();
+  for (uint32_t local = 0; local < locals; local++)
+    ir.locals.push_back(ir.load(local, token.offset));
+}
+
+uint32_t Parser::import(const Token &module, const Token &name) {
+  const std::string from(lexer.view(module), token_text(module).length);
+  const std::string function(lexer.view(name), token_text(name).length);
+  for (uint32_t slot = 0; slot < imports.size(); slot++) {
+    if (imports[slot].module == from && imports[slot].name == function)
+      return slot;
+  }
+  if (imports.size() > UINT16_MAX)
+    Logger::fatal("Too many imports");
+  imports.push_back({from, function});
+  return static_cast<uint32_t>(imports.size() - 1);
 }
 
 bool Parser::match(const Type type) {
-  if (current_token.type == type) {
+  if (current_token->type == type) {
     advance();
     return true;
   }
@@ -27,38 +463,111 @@ bool Parser::match(const Type type) {
 
 ParseRule &get_rule(Type token_type);
 
-static NudFn parse_fxn = [](Parser &parser, const Token &) {
-  const auto name = static_cast<const char *>(
-    parser.consume(Types::NAME, "Expected function name").value.ptr);
+static NudFn parse_fxn = [](Parser &parser, const Token &token) {
+  const Token  name   = parser.consume(Types::NAME, "Expected function name");
+  const char  *text   = parser.lexer.view(name);
+  const size_t length = token_text(name).length;
+
+  // Known before the body, which can call the function itself. Calls
+  // further up declared it already.
+  Symbol    *symbol   = parser.symbols.lookup(text, length);
+  const bool declared = symbol && symbol->type == SymbolType::FUNCTION &&
+                        symbol->location < 0;
+  if (symbol && !declared)
+    Logger::fatal("Function already defined");
+  if (!symbol) {
+    if (!parser.symbols.insert(text, length, -1, SymbolType::FUNCTION))
+      Logger::fatal("Function already defined");
+    symbol = parser.symbols.lookup(text, length);
+  }
 
-  // TODO: Accept parameters
+  // The body runs in a frame of its own, the parameters are its first locals
+  Scope outer         = std::move(parser.scope);
+  parser.scope        = Scope();
+  parser.scope.script = false;
   parser.consume(Types::L_PAREN, "Expected '(' after function name");
   if (!parser.match(Types::R_PAREN)) {
-    Logger::fatal("Expected ')' after function name");
+    do {
+      // The type in front of the name is optional
+      Token param = parser.consume(Types::NAME, "Expected parameter name");
+      if (parser.current_token->type == Types::NAME)
+        param = parser.consume(Types::NAME, "Expected parameter name");
+      // Declared types are not checked yet, they say nothing of the value
+      const uint32_t local = parser.declare(param, SymbolType::F64);
+      if (parser.optimization)
+        parser.scope.ir.locals[local] = parser.scope.ir.param(param.offset);
+    } while (parser.match(Types::COMMA));
+    parser.consume(Types::R_PAREN, "Expected ')' after parameters");
   }
+  if (declared && symbol->arity != parser.scope.count)
+    Logger::fatal("Wrong number of arguments");
+  symbol->arity = static_cast<uint8_t>(parser.scope.count);
 
-  parser.chunk.write(OpCodes::FX_ENTRY);
+  // Functions defined in the body are written inside it, and skipped
+  const int entry = parser.chunk.pos;
+  parser.mark(token);
+  write_entry(parser.chunk);
+  symbol->location = parser.chunk.pos;
+  patch_calls(parser, std::string(text, length), symbol->location);
 
-  // Parse function body
   parser.consume(Types::L_CURLY, "Expected '{' to start function body");
-  const size_t start_address = parser.chunk.pos;
-  while (!parser.match(Types::R_CURLY) /* && !parser.is_at_end() */) {
+  while (!parser.match(Types::R_CURLY)) {
     parser.parse_expression(Precedence::NUL);
+    parser.match(Types::SEMICOLON);
+  }
+  parser.emit(OpCodes::FX_EXIT, *parser.prev_token);
+  if (parser.optimization)
+    parser.lower(parser.scope.ir);
+  patch_entry(parser.chunk, entry);
+  mark_tail_calls(parser.chunk, symbol->location);
+
+  // Lowering optimized the body, which is what calls to it inline
+  if (parser.optimization >= 2) {
+    Inlinee &inlinee = parser.inlinees[std::string(text, length)];
+    inlinee.blocker  = ir_inline_blocker(parser.scope.ir);
+    for (const IrInstr &instr : parser.scope.ir.instrs) {
+      if (instr.op == OpCodes::CALL && find(parser, instr.value.slice) == symbol)
+        inlinee.blocker = "it is recursive";
+    }
+    if (parser.scope.branched)
+      inlinee.blocker = "it branches";
+    if (!inlinee.blocker)
+      inlinee.body = std::move(parser.scope.ir);
   }
-  // const size_t end_address = parser.chunk.pos;
+  parser.scope = std::move(outer);
 
-  // Emit bytecode for function definition
-  // parser.chunk.write(static_cast<uint8_t>(parameters.size()));
-  // for (const auto &param : parameters) {
-  // parser.chunk.write(param.c_str());
-  // }
-  parser.chunk.write(OpCodes::FX_EXIT);
+  // Top-level functions can be imported by other modules
+  if (parser.scope.script)
+    parser.exports.push_back(
+      {std::string(text, length), symbol->location, symbol->arity});
+};
 
-  // Store function metadata in symbol table
-  const bool insert_result = parser.symbols.insert(
-    name, static_cast<int>(start_address), SymbolType::FUNCTION);
-  if (!insert_result)
-    Logger::fatal("Out of free symbols");
+// `import name` makes the functions of a module callable as `name:f()`
+static NudFn parse_imp = [](Parser &parser, const Token &) {
+  const Token  name   = parser.consume(Types::NAME, "Expected module name");
+  const char  *text   = parser.lexer.view(name);
+  const size_t length = token_text(name).length;
+  if (const Symbol *symbol = parser.symbols.lookup(text, length)) {
+    if (symbol->type != SymbolType::MODULE)
+      Logger::fatal("Name already defined");
+    return;
+  }
+  if (!parser.symbols.insert(text, length, 0, SymbolType::MODULE))
+    Logger::fatal("Name already defined");
+};
+
+// `from name import f, g` makes them callable as `f()` and `g()`
+static NudFn parse_frm = [](Parser &parser, const Token &) {
+  const Token module = parser.consume(Types::NAME, "Expected module name");
+  parser.consume(Types::IMPORT, "Expected 'import' after module name");
+  do {
+    const Token    name = parser.consume(Types::NAME, "Expected function name");
+    const uint32_t slot = parser.import(module, name);
+    if (!parser.symbols.insert(parser.lexer.view(name),
+          token_text(name).length, static_cast<int>(slot),
+          SymbolType::IMPORT))
+      Logger::fatal("Name already defined");
+  } while (parser.match(Types::COMMA));
 };
 
 static NudFn parse_lit = [](Parser &parser, const Token &token) {
@@ -67,13 +576,11 @@ static NudFn parse_lit = [](Parser &parser, const Token &token) {
     case Types::HEX:
     case Types::OCTAL:
     case Types::BINARY:
-      parser.chunk.write(OpCodes::MOVE);
-      parser.chunk.write(token.index);
-      parser.chunk.write(token.value.f64);
+      parser.emit(parser.lexer.value(token), token);
       break;
     case Types::STR:
-      parser.symbols.insert(
-        static_cast<const char *>(token.value.ptr), 0, SymbolType::STR);
+      parser.symbols.insert(parser.lexer.view(token), token_text(token).length,
+        0, SymbolType::STR);
       break;
     default:
       Logger::fatal("Unknown literal");
@@ -86,13 +593,13 @@ static NudFn parse_unr = [](Parser &parser, const Token &token) {
     case Types::ADD: // unary + does nothing
       break;
     case Types::SUB:
-      parser.chunk.write(OpCodes::NEGATE);
+      parser.emit(OpCodes::NEGATE, token);
       break;
     case Types::L_NOT:
-      parser.chunk.write(OpCodes::NOT);
+      parser.emit(OpCodes::NOT, token);
       break;
     case Types::B_NOT:
-      parser.chunk.write(OpCodes::B_NOT);
+      parser.emit(OpCodes::B_NOT, token);
       break;
     default:
       Logger::fatal("Unknown unary operator");
@@ -109,34 +616,52 @@ static LedFn parse_bin = [](Parser &parser, const Token &token) {
 
   switch (token.type) {
     case Types::ADD:
-      parser.chunk.write(OpCodes::ADD);
+      parser.emit(OpCodes::ADD, token);
       break;
     case Types::SUB:
-      parser.chunk.write(OpCodes::SUB);
+      parser.emit(OpCodes::SUB, token);
       break;
     case Types::MUL:
-      parser.chunk.write(OpCodes::MUL);
+      parser.emit(OpCodes::MUL, token);
       break;
     case Types::DIV:
-      parser.chunk.write(OpCodes::DIV);
+      parser.emit(OpCodes::DIV, token);
       break;
     case Types::L_AND:
-      parser.chunk.write(OpCodes::L_AND);
+      parser.emit(OpCodes::L_AND, token);
       break;
     case Types::L_OR:
-      parser.chunk.write(OpCodes::L_OR);
+      parser.emit(OpCodes::L_OR, token);
       break;
     case Types::B_AND:
-      parser.chunk.write(OpCodes::B_AND);
+      parser.emit(OpCodes::B_AND, token);
       break;
     case Types::B_OR:
-      parser.chunk.write(OpCodes::B_OR);
+      parser.emit(OpCodes::B_OR, token);
       break;
     case Types::CARET:
-      parser.chunk.write(OpCodes::B_XOR);
+      parser.emit(OpCodes::B_XOR, token);
       break;
     case Types::POW:
-      parser.chunk.write(OpCodes::POW);
+      parser.emit(OpCodes::POW, token);
+      break;
+    case Types::CMP_EQ:
+      parser.emit(OpCodes::CMP_EQ, token);
+      break;
+    case Types::CMP_NEQ:
+      parser.emit(OpCodes::CMP_NEQ, token);
+      break;
+    case Types::CMP_LT:
+      parser.emit(OpCodes::CMP_LT, token);
+      break;
+    case Types::CMP_LEQ:
+      parser.emit(OpCodes::CMP_LEQ, token);
+      break;
+    case Types::CMP_GT:
+      parser.emit(OpCodes::CMP_GT, token);
+      break;
+    case Types::CMP_GEQ:
+      parser.emit(OpCodes::CMP_GEQ, token);
       break;
     default:
       Logger::fatal("Unknown binary operator");
@@ -147,46 +672,289 @@ static LedFn parse_rng = [](Parser &parser, const Token &token) {
   parser.parse_expression(get_rule(token.type).precedence);
   switch (token.type) {
     case Types::RANGE_EXCL:
-      parser.chunk.write(OpCodes::RANGE_EXCL);
+      parser.emit(OpCodes::RANGE_EXCL, token);
       break;
     case Types::RANGE_L_IN:
-      parser.chunk.write(OpCodes::RANGE_L_IN);
+      parser.emit(OpCodes::RANGE_L_IN, token);
       break;
     case Types::RANGE_R_IN:
-      parser.chunk.write(OpCodes::RANGE_R_IN);
+      parser.emit(OpCodes::RANGE_R_IN, token);
       break;
     case Types::RANGE_INCL:
-      parser.chunk.write(OpCodes::RANGE_INCL);
+      parser.emit(OpCodes::RANGE_INCL, token);
       break;
     default:
       Logger::fatal("Unknown range operator");
   }
 };
 
-static LedFn parse_dcl = [](Parser &parser, const Token &) {
-  switch (parser.current_token.type) {
+// `{ ... }` of a branch, which leaves the value of its last statement. A
+// branch that leaves nothing gives 0, what else it leaves is not counted.
+static SymbolType parse_block(Parser &parser, const Token &token) {
+  const int    depth = parser.scope.depth;
+  const size_t types = parser.scope.types.size();
+  parser.consume(Types::L_CURLY, "Expected '{'");
+  while (!parser.match(Types::R_CURLY)) {
+    // Values of the statements before the last are of no use, a branch in a
+    // loop would pile them up
+    while (parser.scope.depth > depth)
+      parser.emit(OpCodes::POP, *parser.prev_token);
+    parser.parse_expression(Precedence::NUL);
+    parser.match(Types::SEMICOLON);
+  }
+  if (parser.scope.depth <= depth)
+    parser.emit(0, token);
+  const SymbolType type = parser.scope.types.back();
+  parser.scope.depth    = depth;
+  parser.scope.types.resize(types);
+  return type;
+}
+
+// `if a { ... } else { ... }` gives the value of the branch taken, 0 when
+// there is no `else` and the condition is false
+static NudFn parse_if = [](Parser &parser, const Token &token) {
+  parser.parse_expression(Precedence::NUL);
+  const int  skip      = parser.emit_jump(OpCodes::JUMP_FALSE, token);
+  SymbolType type      = parse_block(parser, token);
+  const int  over      = parser.emit_jump(OpCodes::JUMP, token);
+  const bool otherwise = parser.match(Types::ELSE);
+  parser.patch_jump(skip, parser.label(token));
+
+  if (!otherwise) {
+    parser.emit(0, token);
+  } else if (parser.match(Types::IF)) {
+    const Token chained = *parser.prev_token;
+    get_rule(Types::IF).nud(parser, chained);
+  } else {
+    parser.scope.types.push_back(parse_block(parser, token));
+    parser.scope.depth++;
+  }
+  if (pop_type(parser.scope) != SymbolType::I32)
+    type = SymbolType::F64;
+  parser.scope.types.push_back(type);
+  parser.patch_jump(over, parser.label(token));
+};
+
+// `return value` leaves the function, a bare `return` returns 0
+static NudFn parse_ret = [](Parser &parser, const Token &token) {
+  if (parser.scope.script)
+    Logger::fatal("Return outside of a function");
+  const Type next = parser.current_token->type;
+  if (parser.current_token->flags & TOKEN_NEWLINE || next == Types::R_CURLY ||
+      next == Types::SEMICOLON)
+    parser.emit(0, token);
+  else
+    parser.parse_expression(Precedence::NUL);
+  parser.emit(OpCodes::FX_EXIT, token);
+  parser.settle(token);
+};
+
+// `{ ... }` of a loop, which runs again and again, so none of its
+// statements leaves anything on the stack
+static void parse_body(Parser &parser) {
+  const int depth = parser.scope.depth;
+  parser.consume(Types::L_CURLY, "Expected '{'");
+  while (!parser.match(Types::R_CURLY)) {
+    parser.parse_expression(Precedence::NUL);
+    parser.match(Types::SEMICOLON);
+    while (parser.scope.depth > depth)
+      parser.emit(OpCodes::POP, *parser.prev_token);
+  }
+}
+
+// `while a { ... }` runs the body for as long as the condition holds. Loops
+// are statements, they leave nothing.
+static NudFn parse_whl = [](Parser &parser, const Token &token) {
+  const int top = parser.label(token);
+  parser.parse_expression(Precedence::NUL);
+  const int exit = parser.emit_jump(OpCodes::JUMP_FALSE, token);
+  parse_body(parser);
+  parser.emit_loop(OpCodes::JUMP, top, token);
+  parser.patch_jump(exit, parser.label(token));
+};
+
+// `do { ... } while a` checks the condition after the body, at the jump back
+static NudFn parse_do = [](Parser &parser, const Token &token) {
+  const int top = parser.label(token);
+  parse_body(parser);
+  const Token test = parser.consume(Types::WHILE, "Expected 'while'");
+  parser.parse_expression(Precedence::NUL);
+  parser.emit(OpCodes::NOT, test);
+  parser.emit_loop(OpCodes::JUMP_FALSE, top, test);
+};
+
+// The step of a counted loop, an integer whatever token it is marked with
+static void emit_step(Parser &parser, const Token &token) {
+  parser.emit(1, token);
+  parser.scope.types.back() = SymbolType::I32;
+}
+
+// `for x in a..b { ... }` counts x from a until it reaches b, `=` on either
+// side of the range includes that end as it does for ranges. No range is
+// made, the end is kept in a local of its own and x is declared unless it
+// exists. The condition is checked once before the loop and then at the
+// jump back, after each step.
+static NudFn parse_for = [](Parser &parser, const Token &token) {
+  const Token name = parser.consume(Types::NAME, "Expected loop variable");
+  parser.consume(Types::IN, "Expected 'in' after loop variable");
+  parser.parse_expression(Precedence::RNG);
+  const Token range = *parser.current_token;
+  if (range.type != Types::RANGE_EXCL && range.type != Types::RANGE_L_IN &&
+      range.type != Types::RANGE_R_IN && range.type != Types::RANGE_INCL)
+    Logger::fatal("Expected a range");
+  parser.advance();
+  const bool from = range.type == Types::RANGE_L_IN ||
+                    range.type == Types::RANGE_INCL;
+  const bool to   = range.type == Types::RANGE_R_IN ||
+                    range.type == Types::RANGE_INCL;
+  if (!from) {
+    emit_step(parser, range);
+    parser.emit(OpCodes::ADD, range);
+  }
+
+  const SymbolType start = parser.scope.types.empty()
+                             ? SymbolType::F64
+                             : parser.scope.types.back();
+  const Symbol    *local = parser.scope.locals.lookup(
+    parser.lexer.view(name), token_text(name).length);
+  // Locals inferred to be integers stay integers
+  if (local && local->type == SymbolType::I32 && start != SymbolType::I32)
+    Logger::fatal("Expected an integer");
+  const SymbolType type    = local ? local->type : start;
+  const uint32_t   counter = local ? static_cast<uint32_t>(local->location)
+                                   : parser.declare(name, start);
+  parser.emit_store(counter, name);
+
+  parser.parse_expression(Precedence::RNG);
+  const SymbolType bound = parser.scope.types.empty()
+                             ? SymbolType::F64
+                             : parser.scope.types.back();
+  const uint32_t   end   = parser.reserve();
+  parser.emit_store(end, range);
+
+  parser.emit_load(counter, type, name);
+  parser.emit_load(end, bound, range);
+  parser.emit(to ? OpCodes::CMP_LEQ : OpCodes::CMP_LT, range);
+  const int exit = parser.emit_jump(OpCodes::JUMP_FALSE, token);
+  const int top  = parser.label(token);
+  parse_body(parser);
+
+  parser.emit_load(counter, type, name);
+  emit_step(parser, name);
+  parser.emit(OpCodes::ADD, name);
+  parser.emit_store(counter, name);
+  parser.emit_load(counter, type, name);
+  parser.emit_load(end, bound, range);
+  parser.emit(to ? OpCodes::CMP_GT : OpCodes::CMP_GEQ, range);
+  parser.emit_loop(OpCodes::JUMP_FALSE, top, token);
+  parser.patch_jump(exit, parser.label(token));
+};
+
+// `(a, b)` after the name of a function, returns the number of arguments
+static uint8_t parse_arguments(Parser &parser) {
+  parser.consume(Types::L_PAREN, "Expected '('");
+  uint32_t argc = 0;
+  if (!parser.match(Types::R_PAREN)) {
+    do {
+      parser.parse_expression(Precedence::NUL);
+      argc++;
+    } while (parser.match(Types::COMMA));
+    parser.consume(Types::R_PAREN, "Expected ')' after arguments");
+  }
+  if (argc > UINT8_MAX)
+    Logger::fatal("Too many arguments");
+  return static_cast<uint8_t>(argc);
+}
+
+static NudFn parse_dcl = [](Parser &parser, const Token &token) {
+  // A name ending its line is a reference, what follows is the next statement
+  const bool same_line = !(parser.current_token->flags & TOKEN_NEWLINE);
+  const Type next      = same_line ? parser.current_token->type : Types::END;
+  switch (next) {
     case Types::NAME: {
-      // variable declaration
-      parser.consume(Types::NAME, "Expected variable name");
+      // `type name = value` declares a local
+      const Token name = parser.consume(Types::NAME, "Expected variable name");
       parser.consume(Types::EQ, "Expected assignment");
       parser.parse_expression(Precedence::NUL);
-      parser.symbols.insert("test", 0, SymbolType::I32);
+      parser.emit_store(parser.declare(name, SymbolType::F64), name);
+      break;
+    }
+    case Types::SET_EQ: {
+      // `name $= value` declares a local of the type of its value
+      parser.consume(Types::SET_EQ, "Expected '$='");
+      parser.parse_expression(Precedence::NUL);
+      const SymbolType type = parser.scope.types.empty()
+                                ? SymbolType::F64
+                                : parser.scope.types.back();
+      parser.emit_store(parser.declare(token, type), token);
+      break;
+    }
+    case Types::EQ: {
+      const Symbol *local =
+        parser.scope.locals.lookup(parser.lexer.view(token),
+          token_text(token).length);
+      if (!local)
+        Logger::fatal("Unknown variable");
+      const SymbolType type  = local->type;
+      const auto       index = static_cast<uint32_t>(local->location);
+      parser.consume(Types::EQ, "Expected assignment");
+      parser.parse_expression(Precedence::NUL);
+      // Locals inferred to be integers stay integers
+      if (type == SymbolType::I32 &&
+          (parser.scope.types.empty() ||
+            parser.scope.types.back() != SymbolType::I32))
+        Logger::fatal("Expected an integer");
+      parser.emit_store(index, token);
       break;
     }
     case Types::COLON: {
+      const Symbol *module = parser.symbols.lookup(
+        parser.lexer.view(token), token_text(token).length);
       parser.consume(Types::COLON, "Expected colon");
-      parser.parse_expression(Precedence::NUL);
+      if (!module || module->type != SymbolType::MODULE) {
+        parser.parse_expression(Precedence::NUL);
+        break;
+      }
+      // `module:f()`, the module is only looked at when the call is linked
+      const Token    name = parser.consume(Types::NAME, "Expected function name");
+      const uint32_t slot = parser.import(token, name);
+      parser.emit_call(slot, parse_arguments(parser), name);
       break;
     }
     case Types::L_PAREN: {
-      parser.consume(Types::L_PAREN, "Expected '('");
-      parser.parse_expression(Precedence::GRP);
-      parser.consume(Types::R_PAREN, "Expected ')'");
+      const char   *text   = parser.lexer.view(token);
+      const size_t  length = token_text(token).length;
+      const Symbol *callee = parser.symbols.lookup(text, length);
+      if (callee && callee->type != SymbolType::FUNCTION &&
+          callee->type != SymbolType::IMPORT)
+        Logger::fatal("Unknown function");
+
+      const uint8_t argc = parse_arguments(parser);
+      // A function called before it is defined takes what the first call
+      // passes, the definition is checked against it
+      callee = parser.symbols.lookup(text, length);
+      if (!callee) {
+        if (!parser.symbols.insert(text, length, -1, SymbolType::FUNCTION))
+          Logger::fatal("Name already defined");
+        parser.symbols.lookup(text, length)->arity = argc;
+        callee = parser.symbols.lookup(text, length);
+      }
+      if (callee->type == SymbolType::IMPORT) {
+        parser.emit_call(static_cast<uint32_t>(callee->location), argc, token);
+        break;
+      }
+      if (argc != callee->arity)
+        Logger::fatal("Wrong number of arguments");
+      parser.emit_call(token, argc, token);
       break;
     }
     default: {
-      printf("%i\n", static_cast<int>(parser.current_token.type));
-      Logger::fatal("Unknown declaration");
+      const Symbol *local = parser.scope.locals.lookup(
+        parser.lexer.view(token), token_text(token).length);
+      if (!local)
+        Logger::fatal("Unknown variable");
+      parser.emit_load(
+        static_cast<uint32_t>(local->location), local->type, token);
     }
   }
 };
@@ -196,12 +964,12 @@ static LedFn parse_dcl = [](Parser &parser, const Token &) {
 
 static ParseRule rules[I(Types::MAX_TOKENS)] = {
   [I(Types::ERROR)]      = {Precedence::MAX, parse_nul, parse_nul},
-  [I(Types::CMP_EQ)]     = {Precedence::EQT, parse_nul, parse_nul},
-  [I(Types::CMP_NEQ)]    = {Precedence::EQT, parse_nul, parse_nul},
-  [I(Types::CMP_GT)]     = {Precedence::CMP, parse_nul, parse_nul},
-  [I(Types::CMP_GEQ)]    = {Precedence::CMP, parse_nul, parse_nul},
-  [I(Types::CMP_LT)]     = {Precedence::CMP, parse_nul, parse_nul},
-  [I(Types::CMP_LEQ)]    = {Precedence::CMP, parse_nul, parse_nul},
+  [I(Types::CMP_EQ)]     = {Precedence::EQT, parse_nul, parse_bin},
+  [I(Types::CMP_NEQ)]    = {Precedence::EQT, parse_nul, parse_bin},
+  [I(Types::CMP_GT)]     = {Precedence::CMP, parse_nul, parse_bin},
+  [I(Types::CMP_GEQ)]    = {Precedence::CMP, parse_nul, parse_bin},
+  [I(Types::CMP_LT)]     = {Precedence::CMP, parse_nul, parse_bin},
+  [I(Types::CMP_LEQ)]    = {Precedence::CMP, parse_nul, parse_bin},
   [I(Types::CST_EQ)]     = {Precedence::ASG, parse_nul, parse_nul},
   [I(Types::SET_EQ)]     = {Precedence::ASG, parse_nul, parse_nul},
   [I(Types::EQ)]         = {Precedence::ASG, parse_nul, parse_nul},
@@ -226,20 +994,21 @@ static ParseRule rules[I(Types::MAX_TOKENS)] = {
   [I(Types::CASE)]       = {Precedence::NUL, parse_nul, parse_nul},
   [I(Types::CLASS)]      = {Precedence::NUL, parse_nul, parse_nul},
   [I(Types::DEFAULT)]    = {Precedence::NUL, parse_nul, parse_nul},
-  [I(Types::DO)]         = {Precedence::NUL, parse_nul, parse_nul},
+  [I(Types::DO)]         = {Precedence::NUL, parse_do, parse_nul},
   [I(Types::ELSE)]       = {Precedence::NUL, parse_nul, parse_nul},
   [I(Types::FALSE)]      = {Precedence::NUL, parse_nul, parse_nul},
-  [I(Types::FOR)]        = {Precedence::NUL, parse_nul, parse_nul},
-  [I(Types::FROM)]       = {Precedence::NUL, parse_nul, parse_nul},
+  [I(Types::FOR)]        = {Precedence::NUL, parse_for, parse_nul},
+  [I(Types::FROM)]       = {Precedence::NUL, parse_frm, parse_nul},
   [I(Types::FX)]         = {Precedence::NUL, parse_fxn, parse_nul},
-  [I(Types::IF)]         = {Precedence::NUL, parse_nul, parse_nul},
-  [I(Types::IMPORT)]     = {Precedence::NUL, parse_nul, parse_nul},
+  [I(Types::IF)]         = {Precedence::NUL, parse_if, parse_nul},
+  [I(Types::IMPORT)]     = {Precedence::NUL, parse_imp, parse_nul},
+  [I(Types::IN)]         = {Precedence::NUL, parse_nul, parse_nul},
   [I(Types::NEW)]        = {Precedence::NUL, parse_nul, parse_nul},
-  [I(Types::RETURN)]     = {Precedence::NUL, parse_nul, parse_nul},
+  [I(Types::RETURN)]     = {Precedence::NUL, parse_ret, parse_nul},
   [I(Types::SELECT)]     = {Precedence::NUL, parse_nul, parse_nul},
   [I(Types::SWITCH)]     = {Precedence::NUL, parse_nul, parse_nul},
   [I(Types::TRUE)]       = {Precedence::NUL, parse_nul, parse_nul},
-  [I(Types::WHILE)]      = {Precedence::NUL, parse_nul, parse_nul},
+  [I(Types::WHILE)]      = {Precedence::NUL, parse_whl, parse_nul},
   [I(Types::NUL)]        = {Precedence::NUL, parse_nul, parse_nul},
   [I(Types::STR)]        = {Precedence::LIT, parse_lit, parse_nul},
   [I(Types::NAME)]       = {Precedence::LIT, parse_dcl, parse_nul},
@@ -291,18 +1060,298 @@ ParseRule &get_rule(const Type token_type) {
 }
 
 void Parser::parse() {
+  tokens.reset();
   advance();
-  while (current_token.type != Types::END) {
-    parse_expression(Precedence::NUL);
-    const bool is_stmt =
-      match(Types::SEMICOLON) || current_token.pos.line != prev_token.pos.line;
-    if (!is_stmt || current_token.type == Types::END)
-      chunk.write(OpCodes::RETURN);
+  while (current_token->type != Types::END) {
+    parse_statement();
+  }
+  if (optimization)
+    flush();
+  if (!fixups.empty())
+    Logger::fatal("Unknown function");
+}
+
+// One top-level statement, whether its value is returned depends on the
+// token that follows it. Definitions and declarations have no value.
+void Parser::parse_statement() {
+  const int depth = scope.depth;
+  parse_expression(Precedence::NUL);
+  const bool is_stmt = match(Types::SEMICOLON) ||
+                       current_token->flags & TOKEN_NEWLINE;
+  if ((!is_stmt || current_token->type == Types::END) && scope.depth > depth)
+    emit(OpCodes::RETURN, *prev_token);
+}
+
+// Where a value is kept from its definition to its uses
+typedef enum Placement : uint8_t {
+  PLACE_STACK, // on the VM stack, for the one use that finds it on top
+  PLACE_SLOT,  // stored in a slot and loaded by every use
+  PLACE_MOVE,  // a constant, moved again by every use
+  PLACE_NONE,  // never used, popped right away
+  PLACE_HOME,  // stored in the slot of the local it is assigned to
+} Placement;
+
+// The value a block leaves in a local goes to the slot of the local where it
+// is defined, rather than when the block ends, unless the block reads what
+// the local held on entry later on. Every block of a loop that counts
+// assigns the counter, which then needs no other slot and no moving around.
+static void place_homes(const IrFunction &function,
+  std::vector<Placement> &placement, std::vector<uint8_t> &slot) {
+  if (function.order.empty() ||
+      function.instrs[function.order.back()].op != OpCodes::STORE)
+    return;
+  std::vector<uint32_t> position(function.instrs.size());
+  std::vector<uint32_t> last(function.instrs.size());
+  for (uint32_t p = 0; p < function.order.size(); p++) {
+    position[function.order[p]] = p;
+    for (const uint32_t arg : function.operands_of(function.order[p])) {
+      if (arg != IR_NONE)
+        last[arg] = p;
+    }
+  }
+  // Last use of the value each slot had on entry
+  uint32_t read[UINT8_MAX]{};
+  for (const uint32_t id : function.order) {
+    const IrInstr &instr = function.instrs[id];
+    if (instr.op == OpCodes::LOAD && last[id] > read[instr.value.u32])
+      read[instr.value.u32] = last[id];
+  }
+
+  const auto   values = function.operands_of(function.order.back());
+  const size_t left   = values.end() - values.begin() - function.homes.size();
+  for (size_t i = 0; i < function.homes.size(); i++) {
+    const uint32_t value = values.begin()[left + i];
+    const uint32_t home  = function.homes[i];
+    const OpCode   op    = function.instrs[value].op;
+    if (op == OpCodes::MOVE || op == OpCodes::LOAD ||
+        placement[value] == PLACE_HOME || read[home] > position[value])
+      continue;
+    placement[value] = PLACE_HOME;
+    slot[value]      = static_cast<uint8_t>(home);
+  }
+}
+
+// Values start out on the stack, which is where the parse rules left them.
+// Optimizations share values and move them, so a value whose use does not
+// find it on top of the stack, in operand order, is taken off it until every
+// use does. Parameters are in slots from the start. The results of calls
+// nothing uses do not stay around on the stack, as they do without the IR,
+// so that a function returns the same whatever its body left there.
+static std::vector<Placement> place(
+  const IrFunction &function, std::vector<uint8_t> &slot) {
+  std::vector<Placement> placement(function.instrs.size(), PLACE_STACK);
+  std::vector<uint32_t>  uses(function.instrs.size());
+  for (const uint32_t id : function.order) {
+    for (const uint32_t arg : function.operands_of(id)) {
+      if (arg != IR_NONE && ++uses[arg] > 1)
+        placement[arg] = function.instrs[arg].op == OpCodes::MOVE
+                           ? PLACE_MOVE
+                           : PLACE_SLOT;
+    }
+  }
+  for (const uint32_t id : function.order) {
+    if (function.instrs[id].op == OpCodes::LOAD)
+      placement[id] = PLACE_SLOT;
+    else if (!uses[id] && ir_defines(function.instrs[id].op))
+      placement[id] = PLACE_NONE;
+  }
+  place_homes(function, placement, slot);
+
+  std::vector<uint32_t> stack;
+  std::vector<uint32_t> taken;
+  for (bool changed = true; changed;) {
+    changed = false;
+    stack.clear();
+    for (const uint32_t id : function.order) {
+      // Operands left on the stack are below those loaded for the operation
+      bool fits   = true;
+      bool loaded = false;
+      bool left   = false;
+      taken.clear();
+      for (const uint32_t arg : function.operands_of(id)) {
+        if (arg == IR_NONE) {
+          left = true;
+          continue;
+        }
+        if (placement[arg] != PLACE_STACK) {
+          loaded = true;
+          continue;
+        }
+        fits = fits && !loaded;
+        taken.push_back(arg);
+      }
+      const size_t count = taken.size();
+      for (size_t i = 0; fits && i < count; i++) {
+        fits = stack.size() >= count &&
+               stack[stack.size() - count + i] == taken[i];
+      }
+      // Operands an earlier statement or block left are below all of these
+      if (fits && left && stack.size() > count) {
+        for (size_t i = 0; i < stack.size() - count; i++) {
+          placement[stack[i]] = function.instrs[stack[i]].op == OpCodes::MOVE
+                                  ? PLACE_MOVE
+                                  : PLACE_SLOT;
+        }
+        changed = true;
+      }
+      if (fits) {
+        stack.resize(stack.size() - count);
+      } else {
+        for (const uint32_t arg : taken) {
+          placement[arg] = function.instrs[arg].op == OpCodes::MOVE
+                             ? PLACE_MOVE
+                             : PLACE_SLOT;
+        }
+        changed = true;
+      }
+      if (ir_defines(function.instrs[id].op) && placement[id] == PLACE_STACK)
+        stack.push_back(id);
+    }
+  }
+  return placement;
+}
+
+// Linear scan over the values kept in slots, in execution order. A value
+// takes the lowest slot free where it is defined and frees it at its last
+// use, whose loads come before the value defined there is stored, so the
+// frame holds no more slots than values live at once. Parameters arrive in
+// the slots of their index. A call keeps the slots up to the highest one
+// live across it, the frame of the callee starts above them. Code split into
+// blocks keeps its locals in the slots below `reserved` from one block to
+// the next, no other value goes there.
+static void allocate(const IrFunction &function,
+  const std::vector<Placement> &placement, const uint32_t reserved,
+  std::vector<uint8_t> &slot, std::vector<uint8_t> &keep) {
+  std::vector<uint32_t> last(function.instrs.size());
+  for (uint32_t p = 0; p < function.order.size(); p++) {
+    for (const uint32_t arg : function.operands_of(function.order[p])) {
+      if (arg != IR_NONE)
+        last[arg] = p;
+    }
+  }
+
+  uint32_t busy[UINT8_MAX]{}; // position from which each slot is free
+  uint32_t frame = 0;
+  for (uint32_t p = 0; p < function.order.size(); p++) {
+    const uint32_t id    = function.order[p];
+    const IrInstr &instr = function.instrs[id];
+    if (ir_variadic(instr.op)) {
+      uint32_t kept = reserved;
+      for (uint32_t s = kept; s < frame; s++) {
+        if (busy[s] > p)
+          kept = s + 1;
+      }
+      keep[id] = static_cast<uint8_t>(kept);
+    }
+    if (placement[id] != PLACE_SLOT)
+      continue;
+
+    uint32_t s = reserved;
+    if (instr.op == OpCodes::LOAD) {
+      s = instr.value.u32;
+    } else {
+      while (s < UINT8_MAX && busy[s] > p)
+        s++;
+      if (s == UINT8_MAX)
+        Logger::fatal("Too many values in one function");
+    }
+    busy[s]  = last[id];
+    slot[id] = static_cast<uint8_t>(s);
+    if (s >= frame)
+      frame = s + 1;
+  }
+}
+
+// Whether the operand `back` places from the end of the STORE ending a
+// block is the value of a local in its slot already
+static bool at_home(const IrFunction &function,
+  const std::vector<Placement> &placement, const std::vector<uint8_t> &slot,
+  const size_t back) {
+  if (back > function.homes.size())
+    return false;
+  const auto     values = function.operands_of(function.order.back());
+  const uint32_t value  = values.end()[-static_cast<ptrdiff_t>(back)];
+  return placement[value] == PLACE_HOME &&
+         slot[value] == function.homes[function.homes.size() - back];
+}
+
+void Parser::lower(IrFunction &function) {
+  optimize(function, optimization);
+  std::vector<uint8_t>         slot(function.instrs.size());
+  std::vector<uint8_t>         keep(function.instrs.size());
+  const std::vector<Placement> placement = place(function, slot);
+  allocate(
+    function, placement, scope.branched ? scope.count : 0, slot, keep);
+
+  for (const uint32_t id : function.order) {
+    const IrInstr &instr = function.instrs[id];
+    if (instr.op == OpCodes::MOVE) {
+      if (placement[id] == PLACE_STACK) {
+        mark(instr.offset);
+        write_move(chunk, instr.value.f64);
+      }
+      continue;
+    }
+    // Parameters and locals are in their slots already
+    if (instr.op == OpCodes::LOAD)
+      continue;
+
+    const auto args = function.operands_of(id);
+    for (const uint32_t *at = args.begin(); at != args.end(); at++) {
+      const uint32_t arg = *at;
+      if (arg == IR_NONE || placement[arg] == PLACE_STACK ||
+          (instr.op == OpCodes::STORE && at_home(function, placement, slot,
+                                           args.end() - at)))
+        continue;
+      if (placement[arg] == PLACE_MOVE) {
+        mark(function.instrs[arg].offset);
+        write_move(chunk, function.instrs[arg].value.f64);
+      } else {
+        mark(instr.offset);
+        chunk.write(OpCodes::LOAD);
+        chunk.write(slot[arg]);
+      }
+    }
+    mark(instr.offset);
+    if (instr.op == OpCodes::CALL) {
+      const int offset = call_offset(*this, instr.value.slice);
+      write_call(chunk, instr.op, offset, instr.args[1], keep[id]);
+    } else if (instr.op == OpCodes::STORE) {
+      // Values taken off the stack in reverse, those of the block stay
+      for (size_t i = function.homes.size(); i-- > 0;) {
+        if (at_home(function, placement, slot, function.homes.size() - i))
+          continue;
+        chunk.write(OpCodes::STORE);
+        chunk.write(static_cast<uint8_t>(function.homes[i]));
+      }
+    } else if (instr.op == OpCodes::CALL_EXT) {
+      write_call(chunk, instr.op, static_cast<int>(instr.value.u32),
+        instr.args[1], keep[id]);
+    } else {
+      chunk.write(instr.op);
+    }
+
+    if (placement[id] == PLACE_SLOT || placement[id] == PLACE_HOME) {
+      chunk.write(OpCodes::STORE);
+      chunk.write(slot[id]);
+    } else if (placement[id] == PLACE_NONE) {
+      chunk.write(OpCodes::POP);
+    }
   }
 }
 
+void Parser::flush() {
+  lower(scope.ir);
+  scope.ir.clear();
+  // The locals of the script were values of the IR just lowered
+  scope.locals = SymbolTable();
+  scope.count  = 0;
+}
+
 void Parser::parse_expression(const Precedence precedence) {
-  const Token token = current_token;
+  // Copied, the ring slot can be reused while nested expressions are parsed
+  const Token    token = *current_token;
+  const uint32_t line  = line_breaks;
   advance();
 
   ParseRule rule = get_rule(token.type);
@@ -312,12 +1361,12 @@ void Parser::parse_expression(const Precedence precedence) {
 
   rule.nud(*this, token);
 
-  while (precedence < get_rule(current_token.type).precedence) {
-    Token operator_token = current_token;
+  while (precedence < get_rule(current_token->type).precedence) {
+    const Token operator_token = *current_token;
     if (operator_token.type == Types::END) {
       break;
     }
-    bool same_line = token.pos.line == operator_token.pos.line;
+    bool same_line = line == line_breaks;
 
     rule = get_rule(operator_token.type);
     if (!rule.led && same_line) {
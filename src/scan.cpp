@@ -0,0 +1,419 @@
+#include "scan.h"
+#include "unicode.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_X86_KERNELS 1
+#endif
+
+static bool is_space(const char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\\';
+}
+
+static bool is_ident(const char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '$' || c == '_';
+}
+
+static size_t scalar_space(const char *s, const size_t n) {
+  size_t i = 0;
+  while (i < n && is_space(s[i]))
+    i++;
+  return i;
+}
+
+static size_t scalar_ident(const char *s, const size_t n) {
+  size_t i = 0;
+  while (i < n && is_ident(s[i]))
+    i++;
+  return i;
+}
+
+static size_t scalar_find(
+  const char *s, const size_t n, const char a, const char b, const char c) {
+  size_t i = 0;
+  while (i < n && s[i] != a && s[i] != b && s[i] != c)
+    i++;
+  return i;
+}
+
+static size_t scalar_count(const char *s, const size_t n, const char c) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++)
+    count += s[i] == c;
+  return count;
+}
+
+// Decodes sequence by sequence, ASCII is skipped eight bytes at a time
+static size_t scalar_utf8(const char *s, const size_t n) {
+  size_t i = 0;
+  while (i < n) {
+    if (i + 8 <= n) {
+      uint64_t word;
+      memcpy(&word, s + i, sizeof(word));
+      if (!(word & 0x8080808080808080ULL)) {
+        i += 8;
+        continue;
+      }
+    }
+    uint32_t     code_point;
+    const size_t length = utf8_decode(s + i, n - i, &code_point);
+    if (!length)
+      return i;
+    i += length;
+  }
+  return n;
+}
+
+#ifdef HAS_X86_KERNELS
+
+#define AVX2 __attribute__((target("avx2")))
+
+static __m128i load16(const char *s) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(s));
+}
+
+static __m128i eq16(const __m128i v, const char c) {
+  return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+}
+
+// Bytes in [lo, hi]: the range is shifted down to start at -128 so that a
+// single signed comparison checks both bounds
+static __m128i range16(const __m128i v, const char lo, const char hi) {
+  const __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8(-128 - lo));
+  return _mm_cmplt_epi8(shifted, _mm_set1_epi8(-128 + (hi - lo) + 1));
+}
+
+AVX2 static __m256i load32(const char *s) {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s));
+}
+
+AVX2 static __m256i eq32(const __m256i v, const char c) {
+  return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
+}
+
+AVX2 static __m256i range32(const __m256i v, const char lo, const char hi) {
+  const __m256i shifted = _mm256_add_epi8(v, _mm256_set1_epi8(-128 - lo));
+  return _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + (hi - lo) + 1), shifted);
+}
+
+static unsigned space16(const __m128i v) {
+  const __m128i m = _mm_or_si128(_mm_or_si128(eq16(v, ' '), eq16(v, '\t')),
+    _mm_or_si128(_mm_or_si128(eq16(v, '\r'), eq16(v, '\n')), eq16(v, '\\')));
+  return _mm_movemask_epi8(m);
+}
+
+AVX2 static unsigned space32(const __m256i v) {
+  const __m256i m =
+    _mm256_or_si256(_mm256_or_si256(eq32(v, ' '), eq32(v, '\t')),
+      _mm256_or_si256(
+        _mm256_or_si256(eq32(v, '\r'), eq32(v, '\n')), eq32(v, '\\')));
+  return static_cast<unsigned>(_mm256_movemask_epi8(m));
+}
+
+// OR-ing 0x20 folds upper case letters onto lower case ones
+static unsigned ident16(const __m128i v) {
+  const __m128i alpha = range16(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+  const __m128i m = _mm_or_si128(_mm_or_si128(alpha, range16(v, '0', '9')),
+    _mm_or_si128(eq16(v, '_'), eq16(v, '$')));
+  return _mm_movemask_epi8(m);
+}
+
+AVX2 static unsigned ident32(const __m256i v) {
+  const __m256i alpha =
+    range32(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+  const __m256i m =
+    _mm256_or_si256(_mm256_or_si256(alpha, range32(v, '0', '9')),
+      _mm256_or_si256(eq32(v, '_'), eq32(v, '$')));
+  return static_cast<unsigned>(_mm256_movemask_epi8(m));
+}
+
+static size_t sse2_space(const char *s, const size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    if (const unsigned miss = ~space16(load16(s + i)) & 0xFFFF)
+      return i + __builtin_ctz(miss);
+  }
+  return i + scalar_space(s + i, n - i);
+}
+
+static size_t sse2_ident(const char *s, const size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    if (const unsigned miss = ~ident16(load16(s + i)) & 0xFFFF)
+      return i + __builtin_ctz(miss);
+  }
+  return i + scalar_ident(s + i, n - i);
+}
+
+static size_t sse2_find(
+  const char *s, const size_t n, const char a, const char b, const char c) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i v = load16(s + i);
+    const __m128i m =
+      _mm_or_si128(_mm_or_si128(eq16(v, a), eq16(v, b)), eq16(v, c));
+    if (const unsigned hit = _mm_movemask_epi8(m))
+      return i + __builtin_ctz(hit);
+  }
+  return i + scalar_find(s + i, n - i, a, b, c);
+}
+
+static size_t sse2_count(const char *s, const size_t n, const char c) {
+  size_t count = 0;
+  size_t i     = 0;
+  for (; i + 16 <= n; i += 16) {
+    count += __builtin_popcount(_mm_movemask_epi8(eq16(load16(s + i), c)));
+  }
+  return count + scalar_count(s + i, n - i, c);
+}
+
+// Everything before the first non-ASCII byte of a block is ASCII, the
+// sequences from there on are decoded until the text is ASCII again
+static size_t sse2_utf8(const char *s, const size_t n) {
+  size_t i = 0;
+  while (i + 16 <= n) {
+    const unsigned high = _mm_movemask_epi8(load16(s + i));
+    if (!high) {
+      i += 16;
+      continue;
+    }
+    i += __builtin_ctz(high);
+    do {
+      uint32_t     code_point;
+      const size_t length = utf8_decode(s + i, n - i, &code_point);
+      if (!length)
+        return i;
+      i += length;
+    } while (i < n && s[i] & 0x80);
+  }
+  return i + scalar_utf8(s + i, n - i);
+}
+
+AVX2 static size_t avx2_space(const char *s, const size_t n) {
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    if (const unsigned miss = ~space32(load32(s + i)))
+      return i + __builtin_ctz(miss);
+  }
+  return i + sse2_space(s + i, n - i);
+}
+
+AVX2 static size_t avx2_ident(const char *s, const size_t n) {
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    if (const unsigned miss = ~ident32(load32(s + i)))
+      return i + __builtin_ctz(miss);
+  }
+  return i + sse2_ident(s + i, n - i);
+}
+
+AVX2 static size_t avx2_find(
+  const char *s, const size_t n, const char a, const char b, const char c) {
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const __m256i v = load32(s + i);
+    const __m256i m =
+      _mm256_or_si256(_mm256_or_si256(eq32(v, a), eq32(v, b)), eq32(v, c));
+    if (const auto hit = static_cast<unsigned>(_mm256_movemask_epi8(m)))
+      return i + __builtin_ctz(hit);
+  }
+  return i + sse2_find(s + i, n - i, a, b, c);
+}
+
+AVX2 static size_t avx2_count(const char *s, const size_t n, const char c) {
+  size_t count = 0;
+  size_t i     = 0;
+  for (; i + 32 <= n; i += 32) {
+    const __m256i m = eq32(load32(s + i), c);
+    count += __builtin_popcount(static_cast<unsigned>(_mm256_movemask_epi8(m)));
+  }
+  return count + sse2_count(s + i, n - i, c);
+}
+
+// Keiser and Lemire, "Validating UTF-8 in less than one instruction per
+// byte". Every error shows up in three table lookups indexed by the nibbles
+// of each byte and the byte before it. Only continuations required by a
+// lead two or three bytes back are not caught by those and are checked
+// separately.
+enum Utf8Error : uint8_t {
+  TOO_SHORT      = 1 << 0, // a lead or ASCII byte where a continuation belongs
+  TOO_LONG       = 1 << 1, // a continuation after ASCII
+  OVERLONG_3     = 1 << 2,
+  TOO_LARGE      = 1 << 3,
+  SURROGATE      = 1 << 4,
+  OVERLONG_2     = 1 << 5,
+  TOO_LARGE_1000 = 1 << 6,
+  OVERLONG_4     = 1 << 6,
+  TWO_CONTS      = 1 << 7, // two continuations in a row
+  CARRY          = TOO_SHORT | TOO_LONG | TWO_CONTS,
+};
+
+#define E(x) static_cast<char>(x)
+
+AVX2 static __m256i lookup32(const __m256i table, const __m256i nibbles) {
+  return _mm256_shuffle_epi8(table, nibbles);
+}
+
+AVX2 static __m256i utf8_errors32(const __m256i input, const __m256i previous) {
+  // The bytes one, two and three positions back, across the block boundary
+  const __m256i carried = _mm256_permute2x128_si256(previous, input, 0x21);
+  const __m256i prev1   = _mm256_alignr_epi8(input, carried, 15);
+  const __m256i prev2   = _mm256_alignr_epi8(input, carried, 14);
+  const __m256i prev3   = _mm256_alignr_epi8(input, carried, 13);
+
+  const __m256i low = _mm256_set1_epi8(0x0F);
+  const __m256i byte_1_high = lookup32(
+    _mm256_setr_epi8(E(TOO_LONG), E(TOO_LONG), E(TOO_LONG), E(TOO_LONG),
+      E(TOO_LONG), E(TOO_LONG), E(TOO_LONG), E(TOO_LONG), E(TWO_CONTS),
+      E(TWO_CONTS), E(TWO_CONTS), E(TWO_CONTS), E(TOO_SHORT | OVERLONG_2),
+      E(TOO_SHORT), E(TOO_SHORT | OVERLONG_3 | SURROGATE),
+      E(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4), E(TOO_LONG),
+      E(TOO_LONG), E(TOO_LONG), E(TOO_LONG), E(TOO_LONG), E(TOO_LONG),
+      E(TOO_LONG), E(TOO_LONG), E(TWO_CONTS), E(TWO_CONTS), E(TWO_CONTS),
+      E(TWO_CONTS), E(TOO_SHORT | OVERLONG_2), E(TOO_SHORT),
+      E(TOO_SHORT | OVERLONG_3 | SURROGATE),
+      E(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4)),
+    _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low));
+  const __m256i byte_1_low = lookup32(
+    _mm256_setr_epi8(E(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4),
+      E(CARRY | OVERLONG_2), E(CARRY), E(CARRY), E(CARRY | TOO_LARGE),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4), E(CARRY | OVERLONG_2),
+      E(CARRY), E(CARRY), E(CARRY | TOO_LARGE),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000),
+      E(CARRY | TOO_LARGE | TOO_LARGE_1000)),
+    _mm256_and_si256(prev1, low));
+  const __m256i byte_2_high = lookup32(
+    _mm256_setr_epi8(E(TOO_SHORT), E(TOO_SHORT), E(TOO_SHORT), E(TOO_SHORT),
+      E(TOO_SHORT), E(TOO_SHORT), E(TOO_SHORT), E(TOO_SHORT),
+      E(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |
+        OVERLONG_4),
+      E(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+      E(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+      E(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+      E(TOO_SHORT), E(TOO_SHORT), E(TOO_SHORT), E(TOO_SHORT), E(TOO_SHORT),
+      E(TOO_SHORT), E(TOO_SHORT), E(TOO_SHORT), E(TOO_SHORT), E(TOO_SHORT),
+      E(TOO_SHORT), E(TOO_SHORT),
+      E(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |
+        OVERLONG_4),
+      E(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE),
+      E(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+      E(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE),
+      E(TOO_SHORT), E(TOO_SHORT), E(TOO_SHORT), E(TOO_SHORT)),
+    _mm256_and_si256(_mm256_srli_epi16(input, 4), low));
+  const __m256i special =
+    _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+  // Only leads of three and four byte sequences end up at 0x80 or above
+  const __m256i third =
+    _mm256_subs_epu8(prev2, _mm256_set1_epi8(E(0xE0 - 0x80)));
+  const __m256i fourth =
+    _mm256_subs_epu8(prev3, _mm256_set1_epi8(E(0xF0 - 0x80)));
+  const __m256i must_continue = _mm256_and_si256(
+    _mm256_or_si256(third, fourth), _mm256_set1_epi8(E(0x80)));
+  return _mm256_xor_si256(must_continue, special);
+}
+
+// Blocks of ASCII only check that the block before did not end in the middle
+// of a sequence. The exact position of an error is found by the SSE2 kernel.
+AVX2 static size_t avx2_utf8(const char *s, const size_t n) {
+  // Leads at the end of a block that need more bytes than are left in it
+  const __m256i last_leads = _mm256_setr_epi8(E(0xFF), E(0xFF), E(0xFF),
+    E(0xFF), E(0xFF), E(0xFF), E(0xFF), E(0xFF), E(0xFF), E(0xFF), E(0xFF),
+    E(0xFF), E(0xFF), E(0xFF), E(0xFF), E(0xFF), E(0xFF), E(0xFF), E(0xFF),
+    E(0xFF), E(0xFF), E(0xFF), E(0xFF), E(0xFF), E(0xFF), E(0xFF), E(0xFF),
+    E(0xFF), E(0xFF), E(0xF0 - 1), E(0xE0 - 1), E(0xC0 - 1));
+  __m256i error      = _mm256_setzero_si256();
+  __m256i previous   = _mm256_setzero_si256();
+  __m256i incomplete = _mm256_setzero_si256();
+
+  const auto check = [&](const __m256i input) AVX2 {
+    if (_mm256_movemask_epi8(input)) {
+      error      = _mm256_or_si256(error, utf8_errors32(input, previous));
+      incomplete = _mm256_subs_epu8(input, last_leads);
+    } else {
+      error = _mm256_or_si256(error, incomplete);
+    }
+    previous = input;
+  };
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32)
+    check(load32(s + i));
+  // The zero padding of the last block is ASCII, so it also catches a
+  // sequence cut short by the end
+  char tail[32] = {};
+  memcpy(tail, s + i, n - i);
+  check(load32(tail));
+
+  if (_mm256_testz_si256(error, error))
+    return n;
+  return sse2_utf8(s, n);
+}
+
+#undef E
+#undef AVX2
+
+#endif // HAS_X86_KERNELS
+
+static const Scanner scanners[] = {
+#ifdef HAS_X86_KERNELS
+  {"avx2", avx2_space, avx2_ident, avx2_find, avx2_count, avx2_utf8},
+  {"sse2", sse2_space, sse2_ident, sse2_find, sse2_count, sse2_utf8},
+#endif
+  {"scalar", scalar_space, scalar_ident, scalar_find, scalar_count,
+    scalar_utf8},
+};
+
+static bool supported(const Scanner &candidate) {
+#ifdef HAS_X86_KERNELS
+  if (strcmp(candidate.name, "avx2") == 0) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+  }
+#endif
+  (void)candidate;
+  return true;
+}
+
+static Scanner select_scanner() {
+  for (const auto &candidate : scanners) {
+    if (supported(candidate))
+      return candidate;
+  }
+  return scanners[0];
+}
+
+Scanner scanner = select_scanner();
+
+bool use_scanner(const char *name) {
+  for (const auto &candidate : scanners) {
+    if (strcmp(candidate.name, name) == 0 && supported(candidate)) {
+      scanner = candidate;
+      return true;
+    }
+  }
+  return false;
+}
@@ -3,67 +3,280 @@
 #include <cstdio>
 #include <cstring>
 
-size_t SymbolTable::hash(const char *name) {
-  size_t hash = 5381;
-  while (*name) {
-    hash = (hash << 5) + hash + *name; // hash * 33 + c
-    ++name;
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define SYMBOL_EMPTY   0x80 // never held a symbol, ends a lookup
+#define SYMBOL_REMOVED 0xFE // held one, lookups go on past it
+
+// Eight bytes at a time, mixed by multiplication. The low seven bits go to
+// the control byte, the others pick the group.
+uint32_t SymbolTable::hash(const char *name, const size_t length) {
+  uint64_t hash = 0x9E3779B97F4A7C15ULL ^ length;
+  size_t   i    = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, name + i, sizeof(word));
+    hash = (hash ^ word) * 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 31;
+  }
+  // The rest overlaps the last word, or is read byte by byte when the name
+  // is shorter than one, which avoids a call to memcpy for a few bytes
+  if (i < length) {
+    uint64_t word = 0;
+    if (length >= 8)
+      memcpy(&word, name + length - 8, sizeof(word));
+    else
+      for (; i < length; i++)
+        word |= static_cast<uint64_t>(static_cast<uint8_t>(name[i])) << i * 8;
+    hash = (hash ^ word) * 0xBF58476D1CE4E5B9ULL;
+  }
+  hash ^= hash >> 29;
+  hash *= 0x94D049BB133111EBULL;
+  hash ^= hash >> 32;
+  return static_cast<uint32_t>(hash);
+}
+
+// Bit i is set for each control byte i of the group equal to `byte`
+static uint32_t match(const uint8_t *group, const uint8_t byte) {
+#if defined(__SSE2__)
+  const __m128i bytes =
+    _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+  return static_cast<uint32_t>(_mm_movemask_epi8(
+    _mm_cmpeq_epi8(bytes, _mm_set1_epi8(static_cast<char>(byte)))));
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < SYMBOL_GROUP_SIZE; i++)
+    mask |= static_cast<uint32_t>(group[i] == byte) << i;
+  return mask;
+#endif
+}
+
+// The same for the bytes of slots without a symbol, whose high bit is set
+static uint32_t match_free(const uint8_t *group) {
+#if defined(__SSE2__)
+  return static_cast<uint32_t>(_mm_movemask_epi8(
+    _mm_loadu_si128(reinterpret_cast<const __m128i *>(group))));
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < SYMBOL_GROUP_SIZE; i++)
+    mask |= static_cast<uint32_t>(group[i] >> 7) << i;
+  return mask;
+#endif
+}
+
+// Names of up to 16 bytes are compared with two overlapping words or byte
+// by byte, as most are short enough that calling memcmp is what takes longest
+static bool same_name(const char *a, const char *b, const size_t length) {
+  if (length > 16)
+    return memcmp(a, b, length) == 0;
+  if (length >= 8) {
+    uint64_t x[2];
+    uint64_t y[2];
+    memcpy(&x[0], a, sizeof(x[0]));
+    memcpy(&y[0], b, sizeof(y[0]));
+    memcpy(&x[1], a + length - 8, sizeof(x[1]));
+    memcpy(&y[1], b + length - 8, sizeof(y[1]));
+    return ((x[0] ^ y[0]) | (x[1] ^ y[1])) == 0;
   }
-  return hash % SYMBOL_TABLE_SIZE;
+  for (size_t i = 0; i < length; i++)
+    if (a[i] != b[i])
+      return false;
+  return true;
+}
+
+void print_symbol(const SymbolTable &table, const Symbol *x) {
+  printf("Symbol <%p> { type: %hhu, location: %i, name: \"%.*s\" }\n",
+    static_cast<const void *>(x), static_cast<uint8_t>(x->type), x->location,
+    static_cast<int>(x->length), table.name_of(*x));
+}
+
+SymbolTable::SymbolTable() {
+  memset(first_control, SYMBOL_EMPTY, sizeof(first_control));
+}
+
+// The slots in use are those of the table itself until it grows
+uint8_t *SymbolTable::control() const {
+  return capacity == SYMBOL_INLINE ? const_cast<uint8_t *>(first_control)
+                                       : grown_control.get();
+}
+
+SymbolSlot *SymbolTable::slots() const {
+  return capacity == SYMBOL_INLINE ? const_cast<SymbolSlot *>(first_slots)
+                                       : grown_slots.get();
+}
+
+Symbol &SymbolTable::symbol(uint32_t index) const {
+  if (index < SYMBOL_INLINE)
+    return const_cast<Symbol &>(first[index]);
+  index -= SYMBOL_INLINE;
+  return blocks[index / SYMBOL_BLOCK_SIZE][index % SYMBOL_BLOCK_SIZE];
 }
 
-void print_symbol(Symbol *x) {
-  Symbol s = *x;
-  printf("Symbol <%p> { type: %hhu, in_use: %s, location: %i, name: \"%s\" }\n",
-    static_cast<void *>(x), static_cast<uint8_t>(s.type),
-    s.in_use ? "true" : "false", s.location, s.name);
+const char *SymbolTable::name_of(const Symbol &symbol) const {
+  return names.data() + symbol.name;
 }
 
-Symbol *SymbolTable::get_entry(const char *name) {
-  const size_t idx = hash(name);
-  for (size_t i = 0; i < SYMBOL_TABLE_SIZE; ++i) {
-    const size_t current_idx = (idx + i) % SYMBOL_TABLE_SIZE;
-    Symbol      *entry       = &table[current_idx];
-    if (!entry->in_use) {
-      return entry;
+// Groups are probed at growing distances, which visits every group of a
+// table whose group count is a power of two. Returns the slot of the name,
+// or SIZE_MAX.
+size_t SymbolTable::find(
+  const char *name, const size_t length, const uint32_t hash) const {
+  const uint8_t    *bytes  = control();
+  const SymbolSlot *entries = slots();
+  const size_t      groups = capacity / SYMBOL_GROUP_SIZE;
+  size_t            group  = (hash >> 7) & (groups - 1);
+  for (size_t step = 1;; step++) {
+    const uint8_t *at = bytes + group * SYMBOL_GROUP_SIZE;
+    for (uint32_t mask = match(at, hash & 0x7F); mask; mask &= mask - 1) {
+      const size_t      slot  = group * SYMBOL_GROUP_SIZE + __builtin_ctz(mask);
+      const SymbolSlot &entry = entries[slot];
+      if (entry.hash != hash)
+        continue;
+      const Symbol &found = symbol(entry.symbol);
+      if (found.length == length &&
+          same_name(names.data() + found.name, name, length))
+        return slot;
     }
-    if (strncmp(entry->name, name, SYMBOL_NAME_LEN) == 0) {
-      return entry;
+    if (match(at, SYMBOL_EMPTY) || step == groups)
+      return SIZE_MAX;
+    group = (group + step) & (groups - 1);
+  }
+}
+
+// Puts symbol `index` in the first free slot of its probe sequence
+void SymbolTable::place(const uint32_t hash, const uint32_t index) {
+  uint8_t     *bytes  = control();
+  const size_t groups = capacity / SYMBOL_GROUP_SIZE;
+  size_t       group  = (hash >> 7) & (groups - 1);
+  for (size_t step = 1;; step++) {
+    if (const uint32_t mask = match_free(bytes + group * SYMBOL_GROUP_SIZE)) {
+      const size_t slot = group * SYMBOL_GROUP_SIZE + __builtin_ctz(mask);
+      used += bytes[slot] == SYMBOL_EMPTY;
+      bytes[slot]   = hash & 0x7F;
+      slots()[slot] = {hash, index};
+      return;
     }
+    group = (group + step) & (groups - 1);
+  }
+}
+
+// Doubles the slots once the symbols fill 7/16 of them. Below that it was
+// removed ones that filled the table, then rehashing at the same size clears
+// them.
+void SymbolTable::grow() {
+  const uint32_t                old = capacity;
+  std::unique_ptr<uint8_t[]>    old_control;
+  std::unique_ptr<SymbolSlot[]> old_slots;
+  const uint8_t                *bytes   = control();
+  const SymbolSlot             *entries = slots();
+  if (count >= old * 7 / 16) {
+    // The slots of the table itself stay, grown ones are let go of after
+    old_control = std::move(grown_control);
+    old_slots   = std::move(grown_slots);
+    capacity    = old * 2;
+  } else {
+    old_control.reset(new uint8_t[old]);
+    old_slots.reset(new SymbolSlot[old]);
+    memcpy(old_control.get(), bytes, old);
+    memcpy(old_slots.get(), entries, old * sizeof(SymbolSlot));
+    bytes   = old_control.get();
+    entries = old_slots.get();
   }
-  return nullptr;
+  if (capacity > old) {
+    grown_control.reset(new uint8_t[capacity]);
+    grown_slots.reset(new SymbolSlot[capacity]);
+  }
+  memset(control(), SYMBOL_EMPTY, capacity);
+  used = 0;
+  for (uint32_t i = 0; i < old; i++)
+    if (!(bytes[i] & 0x80))
+      place(entries[i].hash, entries[i].symbol);
 }
 
-void print_table(Symbol *table) {
-  printf("=== TABLE ===\n");
-  for (size_t i = 0; i < SYMBOL_TABLE_SIZE; ++i) {
-    printf("- ");
-    print_symbol(&table[i]);
+// Writes the names of the symbols in use anew, without the removed ones.
+// Removed symbols forget their names, none is reused by the next insert.
+void SymbolTable::compact() {
+  std::string      kept;
+  const uint8_t   *bytes   = control();
+  const SymbolSlot *entries = slots();
+  kept.reserve(names.size() - dropped);
+  for (uint32_t i = 0; i < capacity; i++) {
+    if (bytes[i] & 0x80)
+      continue;
+    Symbol &entry = symbol(entries[i].symbol);
+    kept.append(names, entry.name, entry.length);
+    entry.name = static_cast<uint32_t>(kept.size() - entry.length);
+  }
+  for (const uint32_t index : unused)
+    symbol(index).length = 0;
+  names   = std::move(kept);
+  dropped = 0;
+}
+
+bool SymbolTable::insert(const char *name, const size_t length,
+  const int location, const SymbolType type) {
+  const uint32_t hash = SymbolTable::hash(name, length);
+  if (find(name, length, hash) != SIZE_MAX)
+    return false;
+  // At most seven slots in eight are used, so that probes end early
+  if ((used + 1) * 8 > capacity * 7)
+    grow();
+
+  // Removed symbols are reused first, new ones go at the end of the last
+  // block. A symbol declared again, as the locals of a loop body are, keeps
+  // the name it had.
+  uint32_t index;
+  bool     named = false;
+  if (!unused.empty()) {
+    index = unused.back();
+    unused.pop_back();
+    const Symbol &old = symbol(index);
+    named             = old.length == length &&
+            same_name(names.data() + old.name, name, length);
+    if (named)
+      dropped -= length;
+  } else {
+    index = created++;
+    if (index >= SYMBOL_INLINE &&
+        (index - SYMBOL_INLINE) % SYMBOL_BLOCK_SIZE == 0)
+      blocks.emplace_back(new Symbol[SYMBOL_BLOCK_SIZE]);
   }
-  printf("=============\n");
-}
-
-bool SymbolTable::insert(
-  const char *name, const int location, const SymbolType type) {
-  Symbol *entry = get_entry(name);
-  if (!entry)
-    return false; // No empty bucket found
-  if (strncmp(entry->name, name, SYMBOL_NAME_LEN) == 0)
-    return false; // Already exists
-  snprintf(entry->name, SYMBOL_NAME_LEN - 1, "%s", name);
-  entry->name[SYMBOL_NAME_LEN - 1] = '\0'; // Ensure null-termination
-  entry->location                  = location;
-  entry->type                      = type;
-  entry->in_use                    = true;
-  // print_table(table);
+  Symbol &entry  = symbol(index);
+  entry.type     = type;
+  entry.arity    = 0;
+  entry.location = location;
+  if (!named) {
+    if (names.empty())
+      names.reserve(SYMBOL_INLINE * 4);
+    entry.name   = static_cast<uint32_t>(names.size());
+    entry.length = static_cast<uint32_t>(length);
+    names.append(name, length);
+  }
+  place(hash, index);
+  count++;
+  return true;
+}
+
+bool SymbolTable::remove(const char *name, const size_t length) {
+  const size_t slot = find(name, length, hash(name, length));
+  if (slot == SIZE_MAX)
+    return false;
+  // The name stays until the symbol is reused or half the names are gone
+  const uint32_t index = slots()[slot].symbol;
+  control()[slot]      = SYMBOL_REMOVED;
+  unused.push_back(index);
+  dropped += symbol(index).length;
+  count--;
+  if (dropped * 2 > names.size())
+    compact();
   return true;
 }
 
-Symbol *SymbolTable::lookup(const char *name) {
-  Symbol *entry = get_entry(name);
-  if (!entry)
-    return nullptr; // Not found
-  if (strncmp(entry->name, name, SYMBOL_NAME_LEN) == 0)
-    return entry; // Found
-  return nullptr; // Not found
+Symbol *SymbolTable::lookup(const char *name, const size_t length) const {
+  const size_t slot = find(name, length, hash(name, length));
+  if (slot == SIZE_MAX)
+    return nullptr;
+  return &symbol(slots()[slot].symbol);
 }
@@ -0,0 +1,131 @@
+#include "tokenize.h"
+#include "lexer.h"
+#include "scan.h"
+
+#include <atomic>
+#include <deque>
+#include <thread>
+
+typedef struct LexChunk {
+  size_t             begin; // at the start of a line
+  size_t             end;   // tokens starting here belong to the next chunk
+  Input              input;
+  Lexer              lexer;
+  std::vector<Token> tokens;
+  Token              next{};            // first token at or after `end`
+  bool               next_float{false}; // lexer state right before `next`
+
+  LexChunk(const char *source, const size_t length, const size_t begin,
+    const size_t end)
+    : begin(begin), end(end), input(source, length), lexer(input) {}
+} LexChunk;
+
+// Lexes as if the chunk started on a fresh token boundary, which only holds
+// when the previous chunk did not end inside a string or comment. A line
+// break then always lies between the previous token and the first one.
+static void lex_chunk(LexChunk &chunk) {
+  chunk.lexer.set_soft_errors(true);
+  chunk.lexer.seek(chunk.begin, false, chunk.begin > 0);
+  for (;;) {
+    const bool  carried = chunk.lexer.carries_float();
+    const Token token   = chunk.lexer.advance();
+    if (token.type == Types::END || token.offset >= chunk.end) {
+      chunk.next       = token;
+      chunk.next_float = carried;
+      return;
+    }
+    chunk.tokens.push_back(token);
+  }
+}
+
+// Splits after the first newline following each evenly spaced offset
+static void split(std::deque<LexChunk> &chunks, const char *source,
+  const size_t length, const size_t count) {
+  size_t begin = 0;
+  for (size_t i = 1; i <= count && begin < length; i++) {
+    size_t end = length;
+    if (i < count) {
+      const size_t target = length / count * i;
+      if (target > begin) {
+        const size_t newline =
+          target + scanner.find(source + target, length - target, '\n', '\n',
+                     '\n');
+        end = newline < length ? newline + 1 : length;
+      } else {
+        continue;
+      }
+    }
+    chunks.emplace_back(source, length, begin, end);
+    begin = end;
+  }
+}
+
+std::vector<Token> tokenize(
+  const char *source, const size_t length, unsigned threads) {
+  if (!threads)
+    threads = 1;
+  size_t count = static_cast<size_t>(threads) * LEX_CHUNKS_PER_THREAD;
+  if (count > length / MIN_LEX_CHUNK)
+    count = length / MIN_LEX_CHUNK;
+  if (!count)
+    count = 1;
+
+  // A deque never moves its elements, each lexer points at its own input
+  std::deque<LexChunk> chunks;
+  split(chunks, source, length, count);
+
+  std::atomic<size_t> claimed{0};
+  const auto          work = [&] {
+    for (size_t i; (i = claimed.fetch_add(1)) < chunks.size();)
+      lex_chunk(chunks[i]);
+  };
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < threads && i < chunks.size(); i++)
+    workers.emplace_back(work);
+  work();
+  for (auto &worker : workers)
+    worker.join();
+
+  // Chunks are stitched in order. A chunk is kept when the token the
+  // previous one ran into starts exactly where the chunk's own first token
+  // does, with no state carried over. Otherwise the lexer that is known to
+  // be in sync carries on through the chunk, with errors reported as usual.
+  std::vector<Token> tokens;
+  Lexer             *lexer = nullptr;
+  Token              pending{};
+  bool               pending_float = false;
+  for (auto &chunk : chunks) {
+    const Token &first = chunk.tokens.empty() ? chunk.next : chunk.tokens[0];
+    const bool   in_sync =
+      lexer ? pending.offset == first.offset && !pending_float : true;
+    if (in_sync && !chunk.lexer.has_failed()) {
+      tokens.insert(tokens.end(), chunk.tokens.begin(), chunk.tokens.end());
+      pending       = chunk.next;
+      pending_float = chunk.next_float;
+      lexer         = &chunk.lexer;
+      continue;
+    }
+    if (!lexer) {
+      // the first chunk failed, lex it again to report the error
+      lexer = &chunk.lexer;
+      lexer->set_soft_errors(false);
+      lexer->seek(0);
+      pending = lexer->advance();
+    }
+    lexer->set_soft_errors(false);
+    while (pending.type != Types::END && pending.offset < chunk.end) {
+      tokens.push_back(pending);
+      pending_float = lexer->carries_float();
+      pending       = lexer->advance();
+    }
+  }
+  tokens.push_back(pending);
+
+  // String constants are numbered in source order
+  uint32_t constant_index = 0;
+  for (auto &token : tokens) {
+    if (token.type == Types::STR)
+      token.payload = constant_index++;
+  }
+  return tokens;
+}
@@ -0,0 +1,91 @@
+#include "tokens.h"
+
+#define RING_MASK (TOKEN_RING_SIZE - 1)
+
+TokenStream::TokenStream(Lexer &lexer, const bool threaded)
+  : lexer(lexer), threaded(threaded) {
+  if (threaded)
+    worker = std::thread(&TokenStream::produce, this);
+}
+
+TokenStream::TokenStream(
+  Lexer &lexer, const Token *tokens, const size_t length)
+  : lexer(lexer), replay(tokens), replay_length(length) {
+  end_token = tokens[length - 1];
+}
+
+TokenStream::~TokenStream() {
+  if (worker.joinable()) {
+    stop.store(true, std::memory_order_relaxed);
+    worker.join();
+  }
+}
+
+void TokenStream::reset() {
+  if (threaded || replay)
+    return;
+  head = 0;
+  tail.store(0, std::memory_order_relaxed);
+  released.store(0, std::memory_order_relaxed);
+  done.store(false, std::memory_order_relaxed);
+}
+
+// Lexes up to one batch starting at `slot`, stopping after the END token
+uint32_t TokenStream::fill(uint32_t slot, bool *ended) {
+  for (int i = 0; i < TOKEN_BATCH; i++) {
+    Token &token = ring[slot++ & RING_MASK];
+    token        = lexer.advance();
+    if (token.type == Types::END) {
+      end_token = token;
+      *ended    = true;
+      break;
+    }
+  }
+  return slot;
+}
+
+void TokenStream::produce() {
+  uint32_t slot  = 0;
+  bool     ended = false;
+  while (!ended) {
+    // Wait until the parser has let go of a whole batch worth of slots
+    while (slot + TOKEN_BATCH - released.load(std::memory_order_acquire) >
+           TOKEN_RING_SIZE) {
+      if (stop.load(std::memory_order_relaxed))
+        return;
+      std::this_thread::yield();
+    }
+    slot = fill(slot, &ended);
+    tail.store(slot, std::memory_order_release);
+  }
+  // published after the last batch so the parser never misses a token
+  done.store(true, std::memory_order_release);
+}
+
+const Token &TokenStream::next() {
+  if (replay) {
+    if (head < replay_length)
+      return replay[head++];
+    return end_token;
+  }
+  if (head == tail.load(std::memory_order_acquire)) {
+    if (!threaded) {
+      if (done.load(std::memory_order_relaxed))
+        return end_token; // the parser may look past the end on errors
+      bool ended = false;
+      tail.store(fill(head, &ended), std::memory_order_relaxed);
+      done.store(ended, std::memory_order_relaxed);
+    } else {
+      while (head == tail.load(std::memory_order_acquire)) {
+        if (done.load(std::memory_order_acquire) &&
+            head == tail.load(std::memory_order_acquire))
+          return end_token;
+        std::this_thread::yield();
+      }
+    }
+  }
+  const Token &token = ring[head++ & RING_MASK];
+  if (threaded && head > TOKEN_HELD)
+    released.store(head - TOKEN_HELD, std::memory_order_release);
+  return token;
+}
@@ -0,0 +1,458 @@
+#include "transpile.h"
+#include "logger.h"
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+extern char **environ;
+
+// The modules written out, in the order calls reached them, and what of the
+// runtime their code needs
+typedef struct Program {
+  std::vector<Module *>                  modules;
+  std::unordered_map<Module *, uint32_t> index;
+  std::vector<std::vector<bool>>         starts;  // of instructions
+  std::vector<std::vector<bool>>         labels;  // code gone to from elsewhere
+  std::vector<uint32_t>                  returns; // module << 16 | ip
+  bool                                   stack{false};
+  bool                                   slots{false};
+  bool                                   frames{false};
+  bool                                   exits{false};
+  bool                                   integers{false};
+  bool                                   bits{false};
+  bool                                   fails{false};
+} Program;
+
+// Appends to the C written so far
+static void put(std::string &out, const char *format, ...) {
+  char    text[0x100];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  out += text;
+}
+
+static uint32_t add_module(Program &program, Module *module) {
+  if (const auto found = program.index.find(module);
+      found != program.index.end())
+    return found->second;
+  const auto index = static_cast<uint32_t>(program.modules.size());
+  program.modules.push_back(module);
+  program.index[module] = index;
+  program.starts.emplace_back(module->chunk.pos + 1);
+  program.labels.emplace_back(module->chunk.pos + 1);
+  return index;
+}
+
+static void add_label(Program &program, const uint32_t module, const int at) {
+  if (at < 0 || at > program.modules[module]->chunk.pos)
+    Logger::fatal("Jump out of the code");
+  program.labels[module][at] = true;
+}
+
+static uint16_t operand(const Chunk &chunk, const int ip) {
+  return *reinterpret_cast<const uint16_t *>(chunk.code + ip + 1);
+}
+
+// Of a jump or a call, short jumps have a one byte offset
+static int target(const Chunk &chunk, const int ip) {
+  if (instruction_size(static_cast<OpCode>(chunk.code[ip])) == 2)
+    return ip + static_cast<int8_t>(chunk.code[ip + 1]);
+  return ip + *reinterpret_cast<const int16_t *>(chunk.code + ip + 1);
+}
+
+static bool is_call(const OpCode op) {
+  return op == OpCodes::CALL || op == OpCodes::CALL_EXT ||
+         op == OpCodes::TAILCALL;
+}
+
+// Where jumps, calls and returns go needs a label. What the code uses of the
+// state of the VM is noted, the program leaves out the rest. Imports are
+// linked here, the modules they name are written out as well.
+static void find_labels(Program &program, ModuleCache &modules,
+  const uint32_t m) {
+  Module      &module = *program.modules[m];
+  const Chunk &chunk  = module.chunk;
+  for (int ip = 0; ip < chunk.pos;) {
+    const auto op   = static_cast<OpCode>(chunk.code[ip]);
+    const int  size = instruction_size(op);
+    if (ip + size > chunk.pos)
+      Logger::fatal("Truncated instruction");
+    program.starts[m][ip] = true;
+    program.stack = program.stack || op != OpCodes::FX_ENTRY;
+    program.slots = program.slots || op == OpCodes::LOAD ||
+                    op == OpCodes::STORE ||
+                    (is_call(op) && chunk.code[ip + 3] > 0);
+    program.frames = program.frames || is_call(op) || op == OpCodes::FX_EXIT;
+    program.exits  = program.exits || op == OpCodes::FX_EXIT;
+    switch (op) {
+      case OpCodes::FX_ENTRY:
+        add_label(program, m, ip + 3 + operand(chunk, ip));
+        break;
+      case OpCodes::JUMP:
+      case OpCodes::JUMP_FALSE:
+      case OpCodes::JUMP_SHORT:
+      case OpCodes::JUMP_FALSE_SHORT:
+      case OpCodes::TAILCALL:
+        add_label(program, m, target(chunk, ip));
+        break;
+      case OpCodes::CALL:
+        add_label(program, m, target(chunk, ip));
+        add_label(program, m, ip + 5);
+        program.returns.push_back(m << 16 | (ip + 5));
+        break;
+      case OpCodes::CALL_EXT: {
+        const ModuleLink   &link   = modules.link(module, operand(chunk, ip));
+        const ModuleExport &callee = link.module->exports[link.slot];
+        const uint32_t      callee_module = add_module(program, link.module);
+        if (callee.arity == chunk.code[ip + 3])
+          add_label(program, callee_module, callee.location);
+        add_label(program, m, ip + 5);
+        program.returns.push_back(m << 16 | (ip + 5));
+        break;
+      }
+      default:
+        break;
+    }
+    ip += size;
+  }
+  program.starts[m][chunk.pos] = true;
+}
+
+// C of the operations the VM does in place on the values on top of the
+// stack, null for the others
+static const char *binary_operation(const OpCode op) {
+  switch (op) {
+    case OpCodes::ADD:
+      return "stack[sp - 1] + stack[sp]";
+    case OpCodes::SUB:
+      return "stack[sp - 1] - stack[sp]";
+    case OpCodes::MUL:
+      return "stack[sp - 1] * stack[sp]";
+    case OpCodes::DIV:
+      return "stack[sp - 1] / stack[sp]";
+    case OpCodes::POW:
+      return "pow(stack[sp - 1], stack[sp])";
+    case OpCodes::L_AND:
+      return "stack[sp - 1] && stack[sp]";
+    case OpCodes::L_OR:
+      return "stack[sp - 1] || stack[sp]";
+    case OpCodes::CMP_EQ:
+      return "stack[sp - 1] == stack[sp]";
+    case OpCodes::CMP_NEQ:
+      return "stack[sp - 1] != stack[sp]";
+    case OpCodes::CMP_LT:
+      return "stack[sp - 1] < stack[sp]";
+    case OpCodes::CMP_LEQ:
+      return "stack[sp - 1] <= stack[sp]";
+    case OpCodes::CMP_GT:
+      return "stack[sp - 1] > stack[sp]";
+    case OpCodes::CMP_GEQ:
+      return "stack[sp - 1] >= stack[sp]";
+    case OpCodes::I32_AND:
+      return "i32_bits(stack[sp - 1]) & i32_bits(stack[sp])";
+    case OpCodes::I32_OR:
+      return "i32_bits(stack[sp - 1]) | i32_bits(stack[sp])";
+    case OpCodes::I32_XOR:
+      return "i32_bits(stack[sp - 1]) ^ i32_bits(stack[sp])";
+    default:
+      return nullptr;
+  }
+}
+
+static const char *unary_operation(const OpCode op) {
+  switch (op) {
+    case OpCodes::NEGATE:
+      return "-stack[sp]";
+    case OpCodes::NOT:
+      return "!stack[sp]";
+    case OpCodes::I32_NOT:
+      return "~i32_bits(stack[sp])";
+    default:
+      return nullptr;
+  }
+}
+
+static bool is_integer_operation(const OpCode op) {
+  return op == OpCodes::I32_AND || op == OpCodes::I32_OR ||
+         op == OpCodes::I32_XOR || op == OpCodes::I32_NOT;
+}
+
+// Constants are written in hexadecimal, which C reads back exactly. Those
+// without a literal are written as their bits, NaN keeps its sign.
+static void put_number(Program &program, std::string &out,
+  const double number) {
+  if (std::isfinite(number)) {
+    put(out, "%a", number);
+    return;
+  }
+  uint64_t bits;
+  memcpy(&bits, &number, sizeof(bits));
+  put(out, "from_bits(0x%016llxULL)", static_cast<unsigned long long>(bits));
+  program.bits = true;
+}
+
+// Runtime errors name the position of the instruction, like the VM
+static void put_fail(Program &program, std::string &out, const Chunk &chunk,
+  const int ip, const char *message) {
+  int line   = 0;
+  int column = 0;
+  if (!chunk.lines.find(ip, &line, &column))
+    line = column = 0;
+  put(out, "  fail(\"%s\", %d, %d);\n", message, line, column);
+  program.fails = true;
+}
+
+// Arguments become the first slots of the frame
+static void put_arguments(std::string &out, const int argc) {
+  for (int i = 0; i < argc; i++)
+    put(out, "  slots[base + %d] = stack[sp - %d];\n", i, argc - 1 - i);
+}
+
+static void put_call(Program &program, std::string &out, const uint32_t m,
+  const int ip, const uint32_t callee_module, const int location) {
+  const Chunk &chunk = program.modules[m]->chunk;
+  const int    argc  = chunk.code[ip + 3];
+  const int    keep  = chunk.code[ip + 4];
+  put(out,
+    "  if (fp == MAX_FRAMES || %s + %d + MAX_FRAME_SLOTS > MAX_SLOTS ||\n"
+    "      sp + MAX_FRAME_SLOTS >= MAX_STACK)\n  ",
+    program.slots ? "base" : "0", keep);
+  put_fail(program, out, chunk, ip, "Stack overflow");
+  put(out, "  frames[fp].ip   = 0x%x;\n", m << 16 | (ip + 5));
+  put(out, "  frames[fp++].sp = sp - %d;\n", argc);
+  // Frames only hold slots for code that has any
+  if (program.slots) {
+    put(out, "  frames[fp - 1].base = base;\n");
+    put(out, "  base += %d;\n", keep);
+  }
+  put_arguments(out, argc);
+  put(out, "  sp -= %d;\n", argc);
+  put(out, "  goto m%u_%04x;\n", callee_module, location);
+}
+
+static void put_instruction(Program &program, ModuleCache &modules,
+  std::string &out, const uint32_t m, const int ip) {
+  Module      &module = *program.modules[m];
+  const Chunk &chunk  = module.chunk;
+  const auto   op     = static_cast<OpCode>(chunk.code[ip]);
+  program.integers    = program.integers || is_integer_operation(op);
+
+  switch (op) {
+    case OpCodes::FX_ENTRY:
+      // Functions only run when called, the body is skipped
+      put(out, "  goto m%u_%04x;\n", m, ip + 3 + operand(chunk, ip));
+      return;
+    case OpCodes::MOVE:
+      out += "  stack[++sp] = ";
+      put_number(program, out,
+        *reinterpret_cast<const double *>(chunk.code + ip + 2));
+      out += ";\n";
+      return;
+    case OpCodes::LOAD:
+      put(out, "  stack[++sp] = slots[base + %d];\n", chunk.code[ip + 1]);
+      return;
+    case OpCodes::STORE:
+      put(out, "  slots[base + %d] = stack[sp--];\n", chunk.code[ip + 1]);
+      return;
+    case OpCodes::POP:
+      out += "  sp--;\n";
+      return;
+    case OpCodes::RETURN:
+      out += "  printf(\"%g\\n\", stack[sp--]);\n  return 0;\n";
+      return;
+    case OpCodes::JUMP:
+    case OpCodes::JUMP_SHORT:
+      put(out, "  goto m%u_%04x;\n", m, target(chunk, ip));
+      return;
+    case OpCodes::JUMP_FALSE:
+    case OpCodes::JUMP_FALSE_SHORT:
+      put(out, "  if (stack[sp--] == 0)\n    goto m%u_%04x;\n", m,
+        target(chunk, ip));
+      return;
+    case OpCodes::CALL:
+      put_call(program, out, m, ip, m, target(chunk, ip));
+      return;
+    case OpCodes::CALL_EXT: {
+      const ModuleLink   &link   = modules.link(module, operand(chunk, ip));
+      const ModuleExport &callee = link.module->exports[link.slot];
+      if (callee.arity != chunk.code[ip + 3]) {
+        put_fail(program, out, chunk, ip, "Wrong number of arguments");
+        return;
+      }
+      put_call(program, out, m, ip, program.index[link.module],
+        callee.location);
+      return;
+    }
+    case OpCodes::TAILCALL:
+      // The callee returns straight to the caller, in its frame
+      out += "  if (!fp)\n  ";
+      put_fail(program, out, chunk, ip, "Return outside of a function");
+      put_arguments(out, chunk.code[ip + 3]);
+      out += "  sp = frames[fp - 1].sp;\n";
+      put(out, "  goto m%u_%04x;\n", m, target(chunk, ip));
+      return;
+    case OpCodes::FX_EXIT:
+      // A body that leaves nothing returns 0
+      out += "  if (!fp)\n  ";
+      put_fail(program, out, chunk, ip, "Return outside of a function");
+      out += "  fp--;\n"
+             "  stack[frames[fp].sp + 1] =\n"
+             "    sp > frames[fp].sp ? stack[sp] : 0;\n"
+             "  sp   = frames[fp].sp + 1;\n";
+      if (program.slots)
+        out += "  base = frames[fp].base;\n";
+      out += "  ip   = frames[fp].ip;\n"
+             "  goto dispatch;\n";
+      return;
+    case OpCodes::RANGE_EXCL:
+    case OpCodes::RANGE_L_IN:
+    case OpCodes::RANGE_R_IN:
+    case OpCodes::RANGE_INCL:
+      out += "  printf(\"Range [%g, %g]\\n\", stack[sp - 1], stack[sp]);\n"
+             "  stack[--sp] = 0;\n";
+      return;
+    case OpCodes::B_AND:
+      put_fail(program, out, chunk, ip, "& can only be applied to integers");
+      return;
+    case OpCodes::B_NOT:
+      put_fail(program, out, chunk, ip, "~ can only be applied to integers");
+      return;
+    default:
+      break;
+  }
+  if (const char *operation = binary_operation(op)) {
+    put(out, "  stack[sp - 1] = %s;\n  sp--;\n", operation);
+  } else if (const char *operation = unary_operation(op)) {
+    put(out, "  stack[sp] = %s;\n", operation);
+  } else {
+    put_fail(program, out, chunk, ip, "Unknown opcode");
+  }
+}
+
+// Code running off the end of a module ends the program, as it ends the VM
+static void put_code(Program &program, ModuleCache &modules,
+  std::string &out, const uint32_t m) {
+  const Chunk &chunk = program.modules[m]->chunk;
+  for (int ip = 0; ip < chunk.pos;) {
+    if (program.labels[m][ip])
+      put(out, "m%u_%04x:\n", m, ip);
+    put_instruction(program, modules, out, m, ip);
+    ip += instruction_size(static_cast<OpCode>(chunk.code[ip]));
+  }
+  if (program.labels[m][chunk.pos])
+    put(out, "m%u_%04x:\n", m, chunk.pos);
+  out += "  return 0;\n";
+}
+
+std::string transpile(Module &module, ModuleCache &modules) {
+  Program program;
+  add_module(program, &module);
+  for (uint32_t m = 0; m < program.modules.size(); m++)
+    find_labels(program, modules, m);
+  for (uint32_t m = 0; m < program.modules.size(); m++) {
+    for (size_t at = 0; at < program.labels[m].size(); at++) {
+      if (program.labels[m][at] && !program.starts[m][at])
+        Logger::fatal("Jump into an instruction");
+    }
+  }
+
+  std::string body;
+  for (uint32_t m = 0; m < program.modules.size(); m++) {
+    put(body, "  /* %s */\n", program.modules[m]->name.c_str());
+    put_code(program, modules, body, m);
+  }
+  // Returns go back to the instruction after their call
+  if (program.exits) {
+    body += "dispatch:\n  switch (ip) {\n";
+    for (const uint32_t at : program.returns)
+      put(body, "    case 0x%x:\n      goto m%u_%04x;\n", at, at >> 16,
+        at & 0xFFFF);
+    body += "  }\n  return 0;\n";
+  }
+
+  std::string out;
+  put(out, "/* %s, compiled to C by hadron */\n\n", module.name.c_str());
+  out += "#include <math.h>\n"
+         "#include <stdint.h>\n"
+         "#include <stdio.h>\n"
+         "#include <stdlib.h>\n"
+         "#include <string.h>\n\n";
+  put(out, "#define MAX_STACK       %d\n", MAX_STACK);
+  put(out, "#define MAX_SLOTS       %d\n", MAX_SLOTS);
+  put(out, "#define MAX_FRAMES      %d\n", MAX_FRAMES);
+  put(out, "#define MAX_FRAME_SLOTS %d\n\n", MAX_FRAME_SLOTS);
+  if (program.frames)
+    out += "typedef struct Frame {\n"
+           "  int ip;\n"
+           "  int base;\n"
+           "  int sp;\n"
+           "} Frame;\n\n"
+           "static Frame  frames[MAX_FRAMES];\n";
+  if (program.stack)
+    out += "static double stack[MAX_STACK];\n";
+  if (program.slots)
+    out += "static double slots[MAX_SLOTS];\n";
+  out += "\n";
+  if (program.fails)
+    out += "static void fail(const char *message, int line, int column) {\n"
+           "  if (line)\n"
+           "    printf(\"FATAL: %s (line %d, column %d)\\n\", message, line,\n"
+           "      column);\n"
+           "  else\n"
+           "    printf(\"FATAL: %s\\n\", message);\n"
+           "  exit(EXIT_FAILURE);\n"
+           "}\n\n";
+  if (program.integers)
+    out += "static int32_t i32_bits(double value) {\n"
+           "  if (!isfinite(value))\n"
+           "    return 0;\n"
+           "  return (int32_t)(uint32_t)(int64_t)fmod(value, 4294967296.0);\n"
+           "}\n\n";
+  if (program.bits)
+    out += "static double from_bits(uint64_t bits) {\n"
+           "  double value;\n"
+           "  memcpy(&value, &bits, sizeof(value));\n"
+           "  return value;\n"
+           "}\n\n";
+  out += "int main(void) {\n";
+  if (program.stack)
+    out += "  int sp   = -1;\n";
+  if (program.slots)
+    out += "  int base = 0;\n";
+  if (program.frames)
+    out += "  int fp   = 0;\n";
+  if (program.exits)
+    out += "  int ip   = 0;\n";
+  out += body;
+  out += "}\n";
+  return out;
+}
+
+void compile_c(const char *source, const char *path) {
+  const char *cc = getenv("CC");
+  if (!cc || !*cc)
+    cc = "cc";
+  char  optimize[] = "-O2";
+  char  output[]   = "-o";
+  char  math[]     = "-lm";
+  char *argv[]     = {const_cast<char *>(cc), optimize, output,
+        const_cast<char *>(path), const_cast<char *>(source), math, nullptr};
+
+  pid_t pid;
+  int   status;
+  if (posix_spawnp(&pid, cc, nullptr, nullptr, argv, environ) != 0)
+    Logger::fatal("C compiler not found");
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0)
+    Logger::fatal("C compiler failed");
+}
@@ -1,5 +1,6 @@
 #include "vm.h"
 #include "logger.h"
+#include "module.h"
 
 #include <cmath>
 #include <cstdio>
@@ -11,17 +12,162 @@ void print_stack(double stack[], int sp) {
   printf("\n");
 }
 
+// Only reached on failure, so the line table is decoded here and nowhere else
+static void runtime_error(const Chunk &chunk, const int ip, const char *msg) {
+  int line;
+  int column;
+  if (!chunk.lines.find(ip, &line, &column)) {
+    Logger::fatal(msg);
+  }
+  char message[128];
+  snprintf(message, sizeof(message), "%s (line %d, column %d)", msg, line,
+    column);
+  Logger::fatal(message);
+}
+
+void Chunk::overflow() { Logger::fatal("Program too large"); }
+
 InterpretResult VM::interpret(Chunk &chunk) {
-  for (int ip = 0; ip < chunk.pos; ip++) {
+  return run(chunk, nullptr, nullptr);
+}
+
+InterpretResult VM::interpret(Module &module, ModuleCache &modules) {
+  return run(module.chunk, &module, &modules);
+}
+
+void VM::on_loop(const LoopHook hook, void *context) {
+  loop_hook    = hook;
+  loop_context = context;
+}
+
+// Every loop ends with a backward jump, which is where the hook looks in
+void VM::jump_back(const Chunk &chunk, const int ip) {
+  if (loop_hook && !loop_hook(loop_context, chunk, ip))
+    runtime_error(chunk, ip, "Interrupted");
+}
+
+// Calls into another module switch to its code until they return
+InterpretResult VM::run(
+  Chunk &entry, Module *module, ModuleCache *modules) {
+  Chunk *chunk = &entry;
+  for (int ip = 0; ip < chunk->pos; ip++) {
     // print_stack(stack, sp);
-    switch (const auto opcode = static_cast<OpCode>(chunk.code[ip]); opcode) {
+    switch (const auto opcode = static_cast<OpCode>(chunk->code[ip]); opcode) {
       case OpCodes::FX_ENTRY:
-      case OpCodes::FX_EXIT:
+        // Functions only run when called, the body is skipped
+        ip += 2 + *reinterpret_cast<uint16_t *>(chunk->code + ip + 1);
+        break;
+      case OpCodes::CALL:
+      case OpCodes::CALL_EXT: {
+        const auto operand = *reinterpret_cast<uint16_t *>(chunk->code + ip + 1);
+        const int  argc    = chunk->code[ip + 3];
+        const int  keep    = chunk->code[ip + 4];
+        // Every frame gets room for as many slots and values as one can use
+        if (fp == MAX_FRAMES || base + keep + MAX_FRAME_SLOTS > MAX_SLOTS ||
+            sp + MAX_FRAME_SLOTS >= MAX_STACK)
+          runtime_error(*chunk, ip, "Stack overflow");
+        frames[fp++] = {ip + 5, base, sp - argc, module};
+
+        // Calls within a module are relative, others go through an import
+        // slot, which is linked on the first call
+        int target = ip + static_cast<int16_t>(operand);
+        if (opcode == OpCodes::CALL_EXT) {
+          if (!module)
+            runtime_error(*chunk, ip, "Imports need a module");
+          const ModuleLink   &link   = modules->link(*module, operand);
+          const ModuleExport &callee = link.module->exports[link.slot];
+          if (callee.arity != argc)
+            runtime_error(*chunk, ip, "Wrong number of arguments");
+          module = link.module;
+          chunk  = &module->chunk;
+          target = callee.location;
+        }
+
+        base += keep;
+        // Arguments become the first slots of the callee
+        for (int i = 0; i < argc; i++)
+          slots[base + i] = stack[sp - argc + 1 + i];
+        sp -= argc;
+        ip = target - 1;
+        break;
+      }
+      case OpCodes::TAILCALL: {
+        if (!fp)
+          runtime_error(*chunk, ip, "Return outside of a function");
+        // The callee returns straight to the caller, in its frame. The
+        // arguments replace the slots, whatever else the body left goes.
+        const auto offset = *reinterpret_cast<int16_t *>(chunk->code + ip + 1);
+        const int  argc   = chunk->code[ip + 3];
+        for (int i = 0; i < argc; i++)
+          slots[base + i] = stack[sp - argc + 1 + i];
+        sp = frames[fp - 1].sp;
+        ip += offset - 1;
+        break;
+      }
+      case OpCodes::JUMP: {
+        const int offset = *reinterpret_cast<int16_t *>(chunk->code + ip + 1);
+        if (offset < 0)
+          jump_back(*chunk, ip);
+        ip += offset - 1;
         break;
+      }
+      case OpCodes::JUMP_FALSE: {
+        if (stack[sp--] != 0) {
+          ip += 2;
+          break;
+        }
+        const int offset = *reinterpret_cast<int16_t *>(chunk->code + ip + 1);
+        if (offset < 0)
+          jump_back(*chunk, ip);
+        ip += offset - 1;
+        break;
+      }
+      case OpCodes::JUMP_SHORT: {
+        const int offset = static_cast<int8_t>(chunk->code[ip + 1]);
+        if (offset < 0)
+          jump_back(*chunk, ip);
+        ip += offset - 1;
+        break;
+      }
+      case OpCodes::JUMP_FALSE_SHORT: {
+        if (stack[sp--] != 0) {
+          ip++;
+          break;
+        }
+        const int offset = static_cast<int8_t>(chunk->code[ip + 1]);
+        if (offset < 0)
+          jump_back(*chunk, ip);
+        ip += offset - 1;
+        break;
+      }
+      case OpCodes::FX_EXIT: {
+        if (!fp)
+          runtime_error(*chunk, ip, "Return outside of a function");
+        // The value on top is the result, whatever else the body left goes.
+        // A body that leaves nothing returns 0.
+        const Frame  &frame  = frames[--fp];
+        const double  result = sp > frame.sp ? stack[sp] : 0;
+        sp                   = frame.sp;
+        stack[++sp]          = result;
+        base                 = frame.base;
+        ip                   = frame.ip - 1;
+        module               = frame.module;
+        chunk                = module ? &module->chunk : &entry;
+        break;
+      }
       case OpCodes::MOVE:
-        stack[++sp] = *reinterpret_cast<double *>(chunk.code + ip + 2);
+        stack[++sp] = *reinterpret_cast<double *>(chunk->code + ip + 2);
         ip += 9;
         break;
+      case OpCodes::LOAD:
+        stack[++sp] = slots[base + chunk->code[++ip]];
+        break;
+      case OpCodes::POP:
+        sp--;
+        break;
+      case OpCodes::STORE:
+        slots[base + chunk->code[++ip]] = stack[sp--];
+        break;
       case OpCodes::RETURN:
         printf("%g\n", stack[sp--]);
         return INTERPRET_OK;
@@ -56,7 +202,46 @@ InterpretResult VM::interpret(Chunk &chunk) {
       case OpCodes::B_AND:
         // stack[sp - 1] = stack[sp - 1] & stack[sp];
         // sp--;
-        Logger::fatal("& can only be applied to integers");
+        runtime_error(*chunk, ip, "& can only be applied to integers");
+        break;
+      case OpCodes::CMP_EQ:
+        stack[sp - 1] = stack[sp - 1] == stack[sp];
+        sp--;
+        break;
+      case OpCodes::CMP_NEQ:
+        stack[sp - 1] = stack[sp - 1] != stack[sp];
+        sp--;
+        break;
+      case OpCodes::CMP_LT:
+        stack[sp - 1] = stack[sp - 1] < stack[sp];
+        sp--;
+        break;
+      case OpCodes::CMP_LEQ:
+        stack[sp - 1] = stack[sp - 1] <= stack[sp];
+        sp--;
+        break;
+      case OpCodes::CMP_GT:
+        stack[sp - 1] = stack[sp - 1] > stack[sp];
+        sp--;
+        break;
+      case OpCodes::CMP_GEQ:
+        stack[sp - 1] = stack[sp - 1] >= stack[sp];
+        sp--;
+        break;
+      case OpCodes::I32_AND:
+        stack[sp - 1] = i32_bits(stack[sp - 1]) & i32_bits(stack[sp]);
+        sp--;
+        break;
+      case OpCodes::I32_OR:
+        stack[sp - 1] = i32_bits(stack[sp - 1]) | i32_bits(stack[sp]);
+        sp--;
+        break;
+      case OpCodes::I32_XOR:
+        stack[sp - 1] = i32_bits(stack[sp - 1]) ^ i32_bits(stack[sp]);
+        sp--;
+        break;
+      case OpCodes::I32_NOT:
+        stack[sp] = ~i32_bits(stack[sp]);
         break;
       case OpCodes::NEGATE:
         stack[sp] = -stack[sp];
@@ -66,7 +251,7 @@ InterpretResult VM::interpret(Chunk &chunk) {
         break;
       case OpCodes::B_NOT:
         // stack[sp] = ~stack[sp];
-        Logger::fatal("~ can only be applied to integers");
+        runtime_error(*chunk, ip, "~ can only be applied to integers");
         break;
       case OpCodes::RANGE_EXCL:
       case OpCodes::RANGE_L_IN:
@@ -76,7 +261,7 @@ InterpretResult VM::interpret(Chunk &chunk) {
         stack[--sp] = 0;
         break;
       default:
-        Logger::fatal("Unknown opcode\n");
+        runtime_error(*chunk, ip, "Unknown opcode");
     }
   }
   return INTERPRET_RUNTIME_ERROR;